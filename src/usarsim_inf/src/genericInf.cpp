@@ -34,11 +34,22 @@ GenericInf::GenericInf ()
   nh = new ros::NodeHandle ();
 }
 
+GenericInf::~GenericInf ()
+{
+  delete nh;
+}
+
 ros::NodeHandle * GenericInf::getNH ()
 {
   return nh;
 }
 
+void
+GenericInf::setNH (const ros::NodeHandle & handle)
+{
+  *nh = handle;
+}
+
 int
 GenericInf::init (GenericInf * siblingIn)
 {
@@ -56,6 +67,19 @@ GenericInf::peerMsg (sw_struct * sw)
   return -1;
 }
 
+int
+GenericInf::peerFlush ()
+{
+  return 1;
+}
+
+unsigned long
+GenericInf::readState (RobotStateSnapshot & state)
+{
+  memset (&state, 0, sizeof (state));
+  return 0;
+}
+
 int
 GenericInf::msgIn (sw_struct * sw)
 {
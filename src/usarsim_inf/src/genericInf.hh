@@ -31,17 +31,26 @@
 #define __genericInf__
 #include "ros/ros.h"
 #include "simware.hh"
+#include "usarsimState.hh"
 
 class GenericInf
 {
 public:
   GenericInf * sibling;
   GenericInf ();
+  virtual ~GenericInf ();
   ros::NodeHandle * getNH ();
+  //! put this interface's topics and callbacks on handle's namespace and
+  //! callback queue instead of the global ones; call before init
+  void setNH (const ros::NodeHandle & handle);
   int init (GenericInf * siblingIn);
   int msgOut ();
   int msgIn (sw_struct * sw);
   virtual int peerMsg (sw_struct * sw);
+  //! the calling thread has no more peerMsg calls for now
+  virtual int peerFlush ();
+  //! copy of the newest robot state; returns 0 if there is none
+  virtual unsigned long readState (RobotStateSnapshot & state);
 protected:
     ros::NodeHandle * nh;
 };
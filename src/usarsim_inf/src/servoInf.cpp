@@ -30,6 +30,7 @@
 #include "servoInf.hh"
 #include <sensor_msgs/image_encodings.h>
 #include "ulapi.hh"
+#include "usarsimCloud.hh"
 
 void
 ServoInf::VelCmdCallback (const geometry_msgs::TwistConstPtr & msg)
@@ -59,6 +60,28 @@ ServoInf::ServoInf ():GenericInf ()
   // set platform pointer to something to avoid core dumps
   basePlatform = &grdVehSettings;
   buildTFTree = false;
+  reportAllocs = false;
+  trajectoryTask = NULL;
+  trajectoryRunning = 0;
+  scanTask = NULL;
+  scanRunning = 0;
+  trajectoryTolerance = 0.1;
+  trajectoryGoalTime = 0.5;
+  registryMutex = ulapi_mutex_new (SERVO_REGISTRY_KEY);
+  ulapi_mutex_set_name (registryMutex, "servoRegistry");
+  jointMutex = ulapi_mutex_new (SERVO_JOINT_KEY);
+  ulapi_mutex_set_name (jointMutex, "servoJoints");
+  staticMutex = ulapi_mutex_new (SERVO_STATIC_KEY);
+  ulapi_mutex_set_name (staticMutex, "servoStatic");
+  // components are never moved once created, since callbacks and other
+  // publish threads hold pointers to them
+  actuators.reserve (SERVO_ACTUATOR_MAX);
+  odometers.reserve (SERVO_COMPONENT_MAX);
+  rangeScanners.reserve (SERVO_COMPONENT_MAX);
+  objectSensors.reserve (SERVO_COMPONENT_MAX);
+  grippers.reserve (SERVO_COMPONENT_MAX);
+  toolchangers.reserve (SERVO_COMPONENT_MAX);
+  rangeImagers.reserve (SERVO_COMPONENT_MAX);
 }
 
 /*const UsarsimActuator*
@@ -68,11 +91,11 @@ ServoInf::getActuator( unsigned int num)
     return NULL;
   return &actuators[num];
 }*/
-std::list<UsarsimActuator>::iterator ServoInf::getActuatorBegin()
+std::vector<UsarsimActuator>::iterator ServoInf::getActuatorBegin()
 {
 	return actuators.begin();
 }
-std::list<UsarsimActuator>::iterator ServoInf::getActuatorEnd()
+std::vector<UsarsimActuator>::iterator ServoInf::getActuatorEnd()
 {
 	return actuators.end();
 }
@@ -95,16 +118,30 @@ const UsarsimSensor* ServoInf::getComponent(unsigned int num)
 	}
 	return &grippers[num];
 }
+/*
+  The platform is read from the robot state, since the publish threads
+  may still be changing basePlatform.
+*/
 const std::string
 ServoInf::getPlatformName()
 {
-  return basePlatform->platformName;
+  RobotStateSnapshot state;
+
+  sibling->readState (state);
+  return std::string (state.platformName);
 }
 
 const geometry_msgs::Vector3 
 ServoInf::getPlatformSize()
 {
-  return basePlatform->platformSize;
+  RobotStateSnapshot state;
+  geometry_msgs::Vector3 size;
+
+  sibling->readState (state);
+  size.x = state.length;
+  size.y = state.width;
+  size.z = state.height;
+  return size;
 }
 
 /* The interface must be initialized prior to use.
@@ -121,11 +158,24 @@ ServoInf::init (GenericInf * usarsimIn)
   else
     ROS_DEBUG ("Parameter /usarsim/odomSensor: %s", odomName.c_str ());
   buildTFTree = false;
+  nh->param < bool > ("/usarsim/allocStats", reportAllocs, false);
+#ifndef USARSIM_COUNT_ALLOCS
+  if (reportAllocs)
+    {
+      ROS_WARN ("servoInf: /usarsim/allocStats needs a build with USARSIM_COUNT_ALLOCS, ignored");
+      reportAllocs = false;
+    }
+#endif
+  nh->param < double >("/usarsim/goalTolerance", trajectoryTolerance, 0.1);
+  nh->param < double >("/usarsim/goalTimeTolerance", trajectoryGoalTime, 0.5);
   
   //initialize joint publisher
-  jointPublisher = n.advertise <sensor_msgs::JointState> ("joint_states", 2);
+  jointPublisher = nh->advertise <sensor_msgs::JointState> ("joint_states", 2);
+  tfPublisher = nh->advertise < tf2_msgs::TFMessage > ("/tf", 100);
   //add the world joint
   addJoint("world_joint", 0.0);
+  dumpStatsService = nh->advertiseService ("dump_stats",
+					 &ServoInf::dumpStatsCallback, this);
 	  
   sibling = usarsimIn;
   servoSetMutex = ulapi_mutex_new (SERVO_SET_KEY);
@@ -134,27 +184,212 @@ ServoInf::init (GenericInf * usarsimIn)
       ROS_ERROR ("Unable to create servoSetMutex");
       return -1;
     }
+  ulapi_mutex_set_name (servoSetMutex, "servoSet");
   ROS_INFO ("servoInf initialized");
   return 1;
 }
+/*
+  Log the lock contention seen so far; the same report is made at
+  shutdown.
+*/
+bool
+ServoInf::dumpStatsCallback (std_srvs::Empty::Request & req,
+			     std_srvs::Empty::Response & res)
+{
+  ulapi_mutex_dump_stats ();
+  return true;
+}
 void ServoInf::setBuildingTFTree()
 {
 	buildTFTree = true;
 }
+/*
+  Every message from the simulator passes through here. The scratch arena
+  is recycled and the heap allocations made while handling the message are
+  charged to allocProbe; in steady state that count should be zero.
+*/
 int
 ServoInf::peerMsg (sw_struct * sw)
+{
+  int retValue;
+  ServoScratch & space = scratchSpace ();
+
+  space.arena.reset ();
+  space.probe.start ();
+  retValue = processMsg (sw);
+  space.probe.stop ();
+  if (reportAllocs)
+    ROS_INFO_THROTTLE (10.,
+		       "servoInf: %lu of %lu messages allocated (%lu total, %lu last), %u arena growths",
+		       space.probe.dirtyMessages, space.probe.messages,
+		       space.probe.allocations, space.probe.lastAllocations,
+		       space.arena.getGrowths ());
+  return retValue;
+}
+
+ServoScratch &
+ServoInf::scratchSpace ()
+{
+  if (threadScratch.get () == NULL)
+    {
+      threadScratch.reset (new ServoScratch);
+      threadScratch->tfCount = 0;
+      threadScratch->jointsDirty = false;
+    }
+  return *threadScratch.get ();
+}
+
+void
+ServoInf::sendTransform (const geometry_msgs::TransformStamped & tf)
+{
+  ServoScratch & space = scratchSpace ();
+  std::vector < geometry_msgs::TransformStamped > &batch =
+    space.tfBatch.transforms;
+
+  frames.set (tf);
+  // entries are overwritten in place, so their strings keep their storage
+  if (space.tfCount < batch.size ())
+    batch[space.tfCount] = tf;
+  else
+    batch.push_back (tf);
+  space.tfCount++;
+}
+
+/*
+  Called by whoever calls peerMsg once it has run out of messages for
+  now, or after a batch of them. Everything the batch sent to /tf goes
+  out as one message, and the joint state once.
+*/
+int
+ServoInf::peerFlush ()
+{
+  ServoScratch & space = scratchSpace ();
+
+  if (space.tfCount > 0)
+    {
+      space.tfBatch.transforms.resize (space.tfCount);
+      publish (tfPublisher, space.tfBatch);
+      space.tfCount = 0;
+    }
+  if (space.jointsDirty)
+    {
+      space.jointsDirty = false;
+      sendJoints ();
+    }
+  return 1;
+}
+
+static bool
+sameTransform (const geometry_msgs::TransformStamped & a,
+	       const geometry_msgs::TransformStamped & b)
+{
+  return a.header.frame_id == b.header.frame_id
+    && a.transform.translation.x == b.transform.translation.x
+    && a.transform.translation.y == b.transform.translation.y
+    && a.transform.translation.z == b.transform.translation.z
+    && a.transform.rotation.x == b.transform.rotation.x
+    && a.transform.rotation.y == b.transform.rotation.y
+    && a.transform.rotation.z == b.transform.rotation.z
+    && a.transform.rotation.w == b.transform.rotation.w;
+}
+
+/*
+  Mounts only change with GEO, so they go out latched on /tf_static and
+  only when they differ from what was sent before. A latched topic keeps
+  just its last message, so every static transform is sent each time.
+*/
+void
+ServoInf::sendStaticTransform (const geometry_msgs::TransformStamped & tf)
+{
+  UsarsimMutexLock lock (staticMutex);
+  unsigned int i;
+
+  frames.set (tf);
+  for (i = 0; i < staticTransforms.size (); i++)
+    if (staticTransforms[i].child_frame_id == tf.child_frame_id)
+      break;
+  if (i < staticTransforms.size ())
+    {
+      if (sameTransform (staticTransforms[i], tf))
+	return;
+      staticTransforms[i] = tf;
+    }
+  else
+    staticTransforms.push_back (tf);
+  UsarsimAllocPause pause;
+  staticBroadcaster.sendTransform (staticTransforms);
+}
+
+/*
+  Publish rates are set per component, by its USARSim name:
+    /usarsim/<name>/maxRate       cap on the full rate topic, Hz (0, none)
+    /usarsim/<name>/decimation    publish every n'th message (1)
+    /usarsim/<name>/throttleRate  rate of <topic>_throttle, Hz (0, no such topic)
+  The side topic lets remote viewers take a slow stream without forcing
+  the full one across the link.
+*/
+bool
+ServoInf::readRates (UsarsimSensor * sen)
+{
+  std::string prefix = "/usarsim/" + sen->name + "/";
+  double maxRate, throttleRate;
+  int decimation;
+
+  nh->param < double >(prefix + "maxRate", maxRate, 0);
+  nh->param < int >(prefix + "decimation", decimation, 1);
+  nh->param < double >(prefix + "throttleRate", throttleRate, 0);
+  sen->rate.configure (maxRate, decimation);
+  sen->sideRate.configure (throttleRate, 1);
+  sen->hasSide = throttleRate > 0;
+  if (maxRate > 0 || decimation > 1 || sen->hasSide)
+    ROS_INFO ("%s: max rate %.1f Hz, decimation %d, throttled copy %.1f Hz",
+	      sen->name.c_str (), maxRate, decimation, throttleRate);
+  return sen->hasSide;
+}
+
+/*
+  Effector status mostly repeats, so it only goes out when it changes and
+  otherwise every /usarsim/<name>/heartbeat seconds, by default
+  /usarsim/heartbeat (1 s). A heartbeat of 0 sends every status.
+*/
+void
+ServoInf::readHeartbeat (UsarsimSensor * sen)
+{
+  double heartbeat;
+
+  nh->param < double >("/usarsim/heartbeat", heartbeat, 1.0);
+  nh->param < double >("/usarsim/" + sen->name + "/heartbeat", heartbeat, heartbeat);
+  sen->change.configure (heartbeat);
+}
+
+/*
+  A component mounted on an actuator link is placed relative to that
+  link as it moves, so only the others are static. Those go out only
+  when setTransform saw their mount move, which keeps the status of
+  every sensor off staticMutex; returns whether the static mount went.
+*/
+bool
+ServoInf::sendMountTransform (UsarsimSensor * sen)
+{
+  if (sen->linkOffset >= 0)
+    {
+      sendTransform (sen->tf);
+      return false;
+    }
+  if (!sen->mountChanged)
+    return false;
+  sen->mountChanged = false;
+  sendStaticTransform (sen->tf);
+  return true;
+}
+
+int
+ServoInf::processMsg (sw_struct * sw)
 {
   int num;
   UsarsimActuator *actPtr;
-  static double previousTime = 0;
   ros::Time currentTime;
   currentTime = ros::Time::now();
-  if( sw->time <= 0. )
-    {
-      sw->time = previousTime;
-      ROS_WARN ("Sensor msg class %s with operand %d without time",
-		swTypeToString (sw->type), sw->op);
-    }
   switch (sw->type)
     {
     case SW_ACT:
@@ -163,34 +398,25 @@ ServoInf::peerMsg (sw_struct * sw)
 	case SW_ACT_STAT:
 	actPtr = actuatorIn(actuators, sw->name);
 	  //num = actuatorIndex (actuators, sw->name);
+	  if( actPtr == NULL )
+	    break;
+	  actPtr->ensureTrajectoryServer();
 	  if( copyActuator( actPtr, sw ) )
 	  {
 	    //actuators[num].pub.publish (actuators[num].jstate);
 	    updateActuatorTF(actPtr, sw, buildTFTree);
 	    if(!buildTFTree)
 	    	publishJoints();
-	    updateActuatorCycle(actPtr);
-	    if(actPtr->isTrajectoryActive() && updateTrajectory(actPtr, sw))
-	    {
-	    	control_msgs::FollowJointTrajectoryResult result;
-	    	if(checkTrajectoryGoal(actPtr, sw))
-	    	{
-	    		ROS_INFO("Trajectory succeeded");
-	    		result.error_code = result.SUCCESSFUL;
-	    	}
-	    	else
-	    	{
-	    		ROS_ERROR("Trajectory aborted: arm position not at goal");
-	    		result.error_code = result.GOAL_TOLERANCE_VIOLATED;
-	    	}
-	    	actPtr->setTrajectoryResult(result);
-	    }
+	    // commands come from the trajectory task; here we only watch
+	    actPtr->updateTrajectoryStatus(sw);
 	  }
 	  
 	  break;
 
 	case SW_ACT_SET:
 	  actPtr = actuatorIn (actuators, sw->name);
+	  if( actPtr == NULL )
+	    break;
 	  if(copyActuator( actPtr, sw ))
 	  {
 	  	publishJoints();
@@ -221,11 +447,13 @@ ServoInf::peerMsg (sw_struct * sw)
 	     sw->data.ins.position.yaw);
 
 	  num = odomSensorIndex (odometers, sw->name);
+	  if (num < 0)
+	    break;
+	  odometers[num].sample (currentTime.toSec ());
 	  if (copyIns (&odometers[num], sw) == 1)
 	    {
-	      rosTfBroadcaster.sendTransform (odometers[num].tf);
-	      if(odometers[num].name == odomName)
-	      	rosTfBroadcaster.sendTransform(basePlatform->tf);
+	      sendTransform (odometers[num].tf);
+	      // the base mount only changes with SET, which sends it
 	      /*
 	      ROS_INFO("Sending transform frame: %s child: %s",
 		       odometers[num].tf.header.frame_id.c_str(),
@@ -238,7 +466,10 @@ ServoInf::peerMsg (sw_struct * sw)
 		   odometers[num].odom.pose.pose.position.x,
 		   odometers[num].odom.pose.pose.position.y);
 	  */
-	  odometers[num].pub.publish (odometers[num].odom);
+	  if (odometers[num].sendFull)
+	    publish (odometers[num].pub, odometers[num].odom);
+	  if (odometers[num].sendSide)
+	    publish (odometers[num].sidePub, odometers[num].odom);
 	  break;
 	case SW_SEN_INS_SET:
 	  ROS_DEBUG ("Ins settings for %s: %f %f,%f,%f %f,%f,%f",
@@ -251,12 +482,14 @@ ServoInf::peerMsg (sw_struct * sw)
 		     sw->data.ins.mount.pitch,
 		     sw->data.ins.mount.yaw);
 	  num = odomSensorIndex (odometers, sw->name);
+	  if (num < 0)
+	    break;
 	  if (copyIns (&odometers[num], sw) == 1)
 	    {
-	      rosTfBroadcaster.sendTransform (odometers[num].tf);
+	      sendTransform (odometers[num].tf);
 	      if(odometers[num].name == odomName)
 	      {
-	      	rosTfBroadcaster.sendTransform (basePlatform->tf);
+	      	sendStaticTransform (basePlatform->tf);
 	      	if(!basePlatform->groundTruthSet)
 	      		ROS_INFO("Ground truth set.");
 	      	basePlatform->groundTruthSet = true;
@@ -370,7 +603,7 @@ ServoInf::peerMsg (sw_struct * sw)
 	      // first time we know about the robot type
 	      if (copyGrdVehSettings (&grdVehSettings, sw) == 1)
 		{
-		  rosTfBroadcaster.sendTransform (grdVehSettings.tf);
+		  sendStaticTransform (grdVehSettings.tf);
 		  /*
 		  ROS_INFO("Sending vehicle transform frame: %s child: %s <%f %f>",
 			   grdVehSettings.tf.header.frame_id.c_str(),
@@ -388,7 +621,7 @@ ServoInf::peerMsg (sw_struct * sw)
 	    }
 	  else
 	    {
-	    rosTfBroadcaster.sendTransform (grdVehSettings.tf);
+	    // the vehicle's settings only change with SET, which sends them
 	    /*
 	    ROS_INFO("Sending vehicle transform frame: %s child: %s <%f %f>",
 		     grdVehSettings.tf.header.frame_id.c_str(),
@@ -406,7 +639,7 @@ ServoInf::peerMsg (sw_struct * sw)
 	      botType = SW_ROBOT_GRD_VEH;
 	      if (copyGrdVehSettings (&grdVehSettings, sw) == 1)
 		{
-		  rosTfBroadcaster.sendTransform (grdVehSettings.tf);
+		  sendStaticTransform (grdVehSettings.tf);
 		  /*
 		  ROS_INFO("Sending vehicle transform frame: %s child: %s <%f %f>",
 			   grdVehSettings.tf.header.frame_id.c_str(),
@@ -428,7 +661,7 @@ ServoInf::peerMsg (sw_struct * sw)
 	    }
 	  else
 	    {
-	      rosTfBroadcaster.sendTransform (grdVehSettings.tf);
+	      sendStaticTransform (grdVehSettings.tf);
 	      /*
 		  ROS_INFO("Sending vehicle transform frame: %s child: %s <%f %f>",
 			   grdVehSettings.tf.header.frame_id.c_str(),
@@ -448,16 +681,22 @@ ServoInf::peerMsg (sw_struct * sw)
 	  ROS_DEBUG ("RangeScanner status for %s at time %f: ",
 		     sw->name.c_str (), sw->time);
 	  num = rangeSensorIndex (rangeScanners, sw->name);
+	  if (num < 0)
+	    break;
+	  rangeScanners[num].sample (currentTime.toSec ());
 	  if (copyRangeScanner (&rangeScanners[num], sw) == 1)
 	    {
-	      rosTfBroadcaster.sendTransform (rangeScanners[num].tf);
+	      sendMountTransform (&rangeScanners[num]);
 	      /*
 	      ROS_INFO("Sending transform frame: %s child: %s",
 		       rangeScanners[num].tf.header.frame_id.c_str(),
 		       rangeScanners[num].tf.child_frame_id.c_str());
 	      ROS_INFO("Sending rangescanner message for %s", sw->name.c_str ());
 	      */
-	      rangeScanners[num].pub.publish (rangeScanners[num].scan);
+	      if (rangeScanners[num].sendFull)
+		publish (rangeScanners[num].pub, rangeScanners[num].scan);
+	      if (rangeScanners[num].sendSide)
+		publish (rangeScanners[num].sidePub, rangeScanners[num].scan);
 	    }
 	  else
 	    {
@@ -486,9 +725,11 @@ ServoInf::peerMsg (sw_struct * sw)
 	     sw->data.rangescanner.mount.yaw);
 	   */
 	  num = rangeSensorIndex (rangeScanners, sw->name);
+	  if (num < 0)
+	    break;
 	  if (copyRangeScanner (&rangeScanners[num], sw) == 1)
 	    {
-	      rosTfBroadcaster.sendTransform (rangeScanners[num].tf);
+	      sendMountTransform (&rangeScanners[num]);
 	      /*
 	      ROS_INFO("Sending transform frame: %s child: %s",
 		       rangeScanners[num].tf.header.frame_id.c_str(),
@@ -514,10 +755,16 @@ ServoInf::peerMsg (sw_struct * sw)
 	{
 		case SW_SEN_OBJECTSENSOR_STAT:
 			num = objectSensorIndex(objectSensors, sw->name);
+			if(num < 0)
+				break;
+			objectSensors[num].sample(currentTime.toSec());
 			if(copyObjectSensor(&objectSensors[num], sw) == 1)
 			{
-				rosTfBroadcaster.sendTransform (objectSensors[num].tf);
-				objectSensors[num].pub.publish(objectSensors[num].objSense);
+				sendMountTransform (&objectSensors[num]);
+				if(objectSensors[num].sendFull)
+					publish (objectSensors[num].pub, objectSensors[num].objSense);
+				if(objectSensors[num].sendSide)
+					publish (objectSensors[num].sidePub, objectSensors[num].objSense);
 			}
 			else
 				ROS_ERROR("Object sensor error for %s: can't copy it.",
@@ -525,8 +772,10 @@ ServoInf::peerMsg (sw_struct * sw)
 			break;
 		case SW_SEN_OBJECTSENSOR_SET:
 			num = objectSensorIndex(objectSensors, sw->name);
+			if(num < 0)
+				break;
 			if(copyObjectSensor(&objectSensors[num], sw) == 1)
-				rosTfBroadcaster.sendTransform (objectSensors[num].tf);
+				sendMountTransform (&objectSensors[num]);
 			else
 				ROS_ERROR("Object sensor error for %s: can't copy it.",
 				sw->name.c_str());
@@ -542,17 +791,22 @@ ServoInf::peerMsg (sw_struct * sw)
 		{
 		case SW_EFF_GRIPPER_STAT:
 			num = gripperEffectorIndex(grippers, sw->name);
+			if(num < 0)
+				break;
 			if(copyGripperEffector(&grippers[num], sw) == 1)
 			{
 				//if we aren't building an URDF file, but this item is mounted on an actuator link, publish it as a joint
 				//otherwise publish its transformation directly.
 				if(!buildTFTree && grippers[num].linkOffset >= 0)
+				{
 					publishJoints();
+					frames.set (grippers[num].tf);
+				}
 				else
-					rosTfBroadcaster.sendTransform (grippers[num].tf);
-				grippers[num].pub.publish(grippers[num].status);
-				if(grippers[num].isActive() && grippers[num].isDone())
-					grippers[num].clearActive();
+					sendMountTransform (&grippers[num]);
+				if(grippers[num].change.pass(grippers[num].status.state, currentTime.toSec()))
+					publish (grippers[num].pub, grippers[num].status);
+				grippers[num].settleCommand();
 			
 			}else
 			{
@@ -561,9 +815,11 @@ ServoInf::peerMsg (sw_struct * sw)
 			break;
 		case SW_EFF_GRIPPER_SET:
 			num = gripperEffectorIndex(grippers, sw->name);
+			if(num < 0)
+				break;
 			if(copyGripperEffector(&grippers[num], sw) == 1)
 			{
-				rosTfBroadcaster.sendTransform (grippers[num].tf);
+				sendMountTransform (&grippers[num]);
 			}else
 			{
 				ROS_ERROR("Gripper effector error for %s: couldn't copy",sw->name.c_str());
@@ -580,15 +836,22 @@ ServoInf::peerMsg (sw_struct * sw)
 		{
 			case SW_EFF_TOOLCHANGER_STAT:
 			num = toolchangerIndex(toolchangers, sw->name);
+			if(num < 0)
+				break;
 			if(copyToolchanger(&toolchangers[num], sw) == 1)
 			{
 				//if we aren't building an URDF file, but this item is mounted on an actuator link, publish it as a joint
 				//otherwise publish its transformation directly.
 				if(!buildTFTree && toolchangers[num].linkOffset >= 0) 
+				{
 					publishJoints();
+					frames.set (toolchangers[num].tf);
+				}
 				else
-					rosTfBroadcaster.sendTransform(toolchangers[num].tf);
-				toolchangers[num].pub.publish(toolchangers[num].status);
+					sendMountTransform (&toolchangers[num]);
+				if(toolchangers[num].change.pass(toolchangers[num].status.effector_status.state << 8 |
+								 toolchangers[num].status.tool_type.type, currentTime.toSec()))
+					publish (toolchangers[num].pub, toolchangers[num].status);
 			}else
 			{
 				ROS_ERROR("Toolchanger error for %s: couldn't copy",sw->name.c_str());
@@ -596,12 +859,17 @@ ServoInf::peerMsg (sw_struct * sw)
 			break;
 			case SW_EFF_TOOLCHANGER_SET:
 			num = toolchangerIndex(toolchangers, sw->name);
+			if(num < 0)
+				break;
 			if(copyToolchanger(&toolchangers[num], sw) == 1)
 			{
 				if(!buildTFTree && toolchangers[num].linkOffset >= 0)
+				{
 					publishJoints();
+					frames.set (toolchangers[num].tf);
+				}
 				else
-					rosTfBroadcaster.sendTransform(toolchangers[num].tf);
+					sendMountTransform (&toolchangers[num]);
 			}else
 			{
 				ROS_ERROR("Toolchanger error for %s: couldn't copy",sw->name.c_str());
@@ -617,20 +885,43 @@ ServoInf::peerMsg (sw_struct * sw)
 	{
 	case SW_SEN_RANGEIMAGER_STAT:
 		num = rangeImagerIndex(rangeImagers, sw->name);
+		if(num < 0)
+			break;
 		if(copyRangeImager(&rangeImagers[num], sw) == 1)
 		{
-			
-			rosTfBroadcaster.sendTransform(rangeImagers[num].tf);
-			rosTfBroadcaster.sendTransform(rangeImagers[num].opticalTransform);
+			//the optical frame hangs off the mount, so it goes with it
+			if(sendMountTransform (&rangeImagers[num]))
+				sendStaticTransform (rangeImagers[num].opticalTransform);
+			//strips go out as each frame arrives, for those that can't wait for the whole scan
+			if(rangeImagers[num].stripPub && rangeImagers[num].stripPub.getNumSubscribers() > 0 &&
+			   sw->data.rangeimager.totalframes != 0)
+			{
+				boost::shared_ptr<sensor_msgs::Image> strip = rangeImagers[num].stripPool.take();
+				boost::shared_ptr<sensor_msgs::CameraInfo> stripInfo = rangeImagers[num].stripInfoPool.take();
+				if(rangeImagers[num].makeStrip(sw->data.rangeimager.frame * sw->data.rangeimager.numberperframe,
+							       sw->data.rangeimager.numberperframe,
+							       sw->data.rangeimager.range, *strip, *stripInfo))
+				{
+					strip->header.stamp = currentTime;
+					stripInfo->header.stamp = currentTime;
+					publish (rangeImagers[num].stripPub, strip);
+					publish (rangeImagers[num].stripInfoPub, stripInfo);
+				}
+			}
 			//since virtual range imaging is slow, wait for a full scan before publishing the camera info and depth image
-			if(rangeImagers[num].isReady())
+			if(rangeImagers[num].scanComplete())
 			{
-				rangeImagers[num].depthImage.header.stamp = currentTime;
-				rangeImagers[num].camInfo.header.stamp = currentTime;
+				boost::shared_ptr<sensor_msgs::CameraInfo> camInfo = rangeImagers[num].camInfoPool.take();
+				*camInfo = rangeImagers[num].camInfo;
+				rangeImagers[num].depthImage->header.stamp = currentTime;
+				camInfo->header.stamp = currentTime;
 				//camera info and depth image need to be published in sync
-				rangeImagers[num].pub.publish(rangeImagers[num].depthImage);
-				rangeImagers[num].cameraInfoPub.publish(rangeImagers[num].camInfo);
-				
+				publish (rangeImagers[num].pub, rangeImagers[num].depthImage);
+				publish (rangeImagers[num].cameraInfoPub, camInfo);
+				//the cloud is projected on its own thread, from the image just published
+				if(rangeImagers[num].cloud && rangeImagers[num].cloud->pub.getNumSubscribers() > 0)
+					rangeImagers[num].cloud->put(rangeImagers[num].depthImage, *camInfo,
+						sw->data.rangeimager.minrange, sw->data.rangeimager.maxrange);
 			}
 		}else
 		{
@@ -639,10 +930,12 @@ ServoInf::peerMsg (sw_struct * sw)
 	break;
 	case SW_SEN_RANGEIMAGER_SET:
 		num = rangeImagerIndex(rangeImagers, sw->name);
+		if(num < 0)
+			break;
 		if(copyRangeImager(&rangeImagers[num], sw) == 1)
 		{
-			rosTfBroadcaster.sendTransform(rangeImagers[num].tf);
-			rosTfBroadcaster.sendTransform(rangeImagers[num].opticalTransform);
+			sendMountTransform (&rangeImagers[num]);
+			sendStaticTransform (rangeImagers[num].opticalTransform);
 		}else
 		{
 			ROS_ERROR("Range imager error for %s: couldn't copy",sw->name.c_str());
@@ -659,7 +952,6 @@ ServoInf::peerMsg (sw_struct * sw)
       break;
     }
 
-  previousTime = sw->time;
   return 1;
 }
 
@@ -667,20 +959,30 @@ int
 ServoInf::msgIn ()
 {
   ROS_INFO ("In servoInf msgIn");
-  static ros::NodeHandle n;	// need new nodehandle for receivingmessages
-
-  // manage subscriptions
-  static ros::Subscriber sub =
-    n.subscribe ("cmd_vel", 10, &ServoInf::VelCmdCallback, this); //vehicle velocity subscriber
-  //static ros::Subscriber opSub = 
-  //  n.subscribe ("cmd_op", 10, &ServoInf::OpCmdCallback, this); //opcode subscriber
+  subscribeCommands ();
+
+  // cmd_vel, trajectory and effector callbacks are served in parallel;
+  // each component guards its own shared state with its stateMutex
+  int spinThreads;
+  nh->param < int >("/usarsim/spinThreads", spinThreads, 4);
+  ROS_DEBUG ("parameter /usarsim/spinThreads: %d", spinThreads);
+  if (spinThreads < 1)
+    spinThreads = 1;
+  ROS_INFO ("servoInf going to spin on %d threads", spinThreads);
   
-  ROS_INFO ("servoInf going to spin");
-  
-  ros::spin ();
+  ros::AsyncSpinner spinner (spinThreads);
+  spinner.start ();
+  ros::waitForShutdown ();
   return 1;
 }
 
+void
+ServoInf::subscribeCommands ()
+{
+  velSub = nh->subscribe ("cmd_vel", 10, &ServoInf::VelCmdCallback, this); //vehicle velocity subscriber
+  //opSub = nh->subscribe ("cmd_op", 10, &ServoInf::OpCmdCallback, this); //opcode subscriber
+}
+
 int
 ServoInf::msgOut (void)
 {
@@ -688,8 +990,191 @@ ServoInf::msgOut (void)
   return 1;
 }
 
+static void
+trajectoryThread (void *arg)
+{
+  reinterpret_cast < ServoInf * >(arg)->runTrajectories ();
+}
+
+/*
+  Start the task that sends the actuators' trajectory commands. Every
+  tick it samples each running trajectory at the current time, so the
+  command rate is /usarsim/trajectoryRate whatever the goal's point
+  spacing or the simulator's status rate.
+*/
+int
+ServoInf::startTrajectories ()
+{
+  double rate;
+  int cpu;
+  bool fifo;
+
+  if (trajectoryTask != NULL)
+    return 1;
+  nh->param < double >("/usarsim/trajectoryRate", rate, 50.);
+  nh->param < int >("/usarsim/trajectoryCpu", cpu, -1);
+  nh->param < bool > ("/usarsim/trajectoryFifo", fifo, false);
+  ROS_DEBUG ("parameter /usarsim/trajectoryRate: %f", rate);
+  if (rate <= 0)
+    {
+      ROS_ERROR ("servoInf: /usarsim/trajectoryRate must be positive");
+      return -1;
+    }
+  __atomic_store_n (&trajectoryRunning, 1, __ATOMIC_SEQ_CST);
+  trajectoryTask = ulapi_task_new ();
+  if (cpu >= 0)
+    ulapi_task_set_cpu (trajectoryTask, cpu);
+  ulapi_task_set_fifo (trajectoryTask, fifo);
+  if (ULAPI_OK != ulapi_task_start (trajectoryTask, trajectoryThread,
+				    (void *) this, ulapi_prio_highest (),
+				    (ulapi_integer) (1.0e9 / rate)))
+    {
+      ROS_ERROR ("servoInf: unable to start the trajectory task");
+      ulapi_task_delete (trajectoryTask);
+      trajectoryTask = NULL;
+      return -1;
+    }
+  ROS_INFO ("servoInf: sampling trajectories at %.1f Hz", rate);
+  return 1;
+}
+
+void
+ServoInf::stopTrajectories ()
+{
+  ulapi_task_stats stats;
+
+  if (trajectoryTask == NULL)
+    return;
+  __atomic_store_n (&trajectoryRunning, 0, __ATOMIC_SEQ_CST);
+  ulapi_task_join (trajectoryTask);
+  ulapi_task_get_stats (trajectoryTask, &stats);
+  ulapi_task_delete (trajectoryTask);
+  trajectoryTask = NULL;
+  ROS_INFO ("servoInf: trajectory task %ld ticks, %ld missed, jitter %.6f s mean %.6f s max",
+	    (long) stats.cycles, (long) stats.misses,
+	    stats.cycles ? (double) stats.jitter_sum / stats.cycles : 0.,
+	    (double) stats.jitter_max);
+}
+
+void
+ServoInf::runTrajectories ()
+{
+  sw_struct sw;
+  unsigned int count;
+  double now;
+
+  while (__atomic_load_n (&trajectoryRunning, __ATOMIC_SEQ_CST))
+    {
+      ulapi_wait (0);
+      // actuators are never moved, so only the count needs the lock
+      ulapi_mutex_take (registryMutex);
+      count = actuators.size ();
+      ulapi_mutex_give (registryMutex);
+      now = ulapi_monotime ();
+      for (unsigned int i = 0; i < count; i++)
+	if (actuators[i].sampleTrajectory (now, &sw))
+	  sibling->peerMsg (&sw);
+    }
+}
+
+static void
+scanThread (void *arg)
+{
+  reinterpret_cast < ServoInf * >(arg)->runScans ();
+}
+
+/*
+  Start the task that sends the continuous range imagers' SCANs that
+  were held back by their scanRate, and asks again for scans that
+  stalled. It ticks at /usarsim/scanPollRate; SCANs that are not held
+  back go out from the publish worker as the frames arrive.
+*/
+int
+ServoInf::startScans ()
+{
+  double rate;
+
+  if (scanTask != NULL)
+    return 1;
+  nh->param < double >("/usarsim/scanPollRate", rate, 50.);
+  ROS_DEBUG ("parameter /usarsim/scanPollRate: %f", rate);
+  if (rate <= 0)
+    {
+      ROS_ERROR ("servoInf: /usarsim/scanPollRate must be positive");
+      return -1;
+    }
+  __atomic_store_n (&scanRunning, 1, __ATOMIC_SEQ_CST);
+  scanTask = ulapi_task_new ();
+  if (ULAPI_OK != ulapi_task_start (scanTask, scanThread, (void *) this,
+				    ulapi_prio_lowest (),
+				    (ulapi_integer) (1.0e9 / rate)))
+    {
+      ROS_ERROR ("servoInf: unable to start the scan task");
+      ulapi_task_delete (scanTask);
+      scanTask = NULL;
+      return -1;
+    }
+  return 1;
+}
+
+void
+ServoInf::stopScans ()
+{
+  if (scanTask == NULL)
+    return;
+  __atomic_store_n (&scanRunning, 0, __ATOMIC_SEQ_CST);
+  ulapi_task_join (scanTask);
+  ulapi_task_delete (scanTask);
+  scanTask = NULL;
+}
+
+void
+ServoInf::runScans ()
+{
+  unsigned int count;
+  double now;
+
+  while (__atomic_load_n (&scanRunning, __ATOMIC_SEQ_CST))
+    {
+      ulapi_wait (0);
+      // range imagers are never moved, so only the count needs the lock
+      ulapi_mutex_take (registryMutex);
+      count = rangeImagers.size ();
+      ulapi_mutex_give (registryMutex);
+      now = ulapi_time ();
+      for (unsigned int i = 0; i < count; i++)
+	if (rangeImagers[i].pollScan (now))
+	  rangeImagers[i].sendScan ();
+    }
+}
+
+/*
+  Stop and delete the range imagers' point cloud threads. Publish
+  workers hand scans to them, so call this once the pipeline and the
+  socket thread have stopped.
+*/
+void
+ServoInf::stopClouds ()
+{
+  unsigned int count;
+
+  ulapi_mutex_take (registryMutex);
+  count = rangeImagers.size ();
+  ulapi_mutex_give (registryMutex);
+  for (unsigned int i = 0; i < count; i++)
+    if (rangeImagers[i].cloud != NULL)
+      {
+	rangeImagers[i].cloud->stop ();
+	delete rangeImagers[i].cloud;
+	rangeImagers[i].cloud = NULL;
+      }
+}
+
 ServoInf::~ServoInf ()
 {
+  stopScans ();
+  stopTrajectories ();
+  stopClouds ();
   if (servoSetMutex != NULL)
     {
       ulapi_mutex_delete (servoSetMutex);
@@ -700,53 +1185,70 @@ ServoInf::~ServoInf ()
 int
 ServoInf::copyActuator (UsarsimActuator * act, const sw_struct * sw)
 {
-  ros::Time currentTime;
-
-  std::stringstream tempSS;
-
-  currentTime = ros::Time::now ();
   act->numJoints = sw->data.actuator.number;
 
-  //define the mounting joint for this actuator
-  addJoint(act->name + "_mount", 0.0);
-  act->minValues.clear();
-  act->maxValues.clear();
-  act->maxTorques.clear();
+  //define the mounting and link joints for this actuator the first time we
+  //see this many links; afterwards only the values are updated
+  if (act->jointIndex.size () != (unsigned int) act->numJoints)
+    nameActuatorJoints (act, act->numJoints);
+  act->minValues.resize(act->numJoints);
+  act->maxValues.resize(act->numJoints);
+  act->maxTorques.resize(act->numJoints);
 
-  //create actuator joints
+  UsarsimMutexLock lock(jointMutex);
   for( int i=0; i<sw->data.actuator.number; i++ )
     {
-      tempSS.str("");
-      tempSS << i+1;
-      
-      addJoint(act->name + std::string("_joint_") + tempSS.str (), sw->data.actuator.link[i].position);
-      
-      act->minValues.push_back(sw->data.actuator.link[i].minvalue);
-      act->maxValues.push_back(sw->data.actuator.link[i].maxvalue);
-      act->maxTorques.push_back(sw->data.actuator.link[i].maxtorque);
+      joints.position[act->jointIndex[i]] = sw->data.actuator.link[i].position;
+      act->minValues[i] = sw->data.actuator.link[i].minvalue;
+      act->maxValues[i] = sw->data.actuator.link[i].maxvalue;
+      act->maxTorques[i] = sw->data.actuator.link[i].maxtorque;
     }
   //  ROS_ERROR( "CopyAct success!!" );
   return 1;
 }
+/*
+Build the frame and joint names of an actuator with the given number of links
+and reserve their slots in the joint state.
+*/
+void ServoInf::nameActuatorJoints(UsarsimActuator *act, int number)
+{
+  act->mountJoint = addJoint(act->name + "_mount", 0.0);
+  act->linkNames.resize(number + 1);
+  for(int i = 0; i <= number; i++)
+    act->linkNames[i] = scratch().printf("%s_link%d", act->name.c_str(), i);
+  act->jointIndex.resize(number);
+  for(int i = 0; i < number; i++)
+    act->jointIndex[i] = addJoint(scratch().printf("%s_joint_%d", act->name.c_str(), i + 1), 0.0);
+  {
+    // trajectory goals name their joints with these
+    UsarsimMutexLock lock(act->stateMutex);
+    act->jointNames.resize(number);
+    for(int i = 0; i < number; i++)
+      act->jointNames[i] = scratch().printf("%s_joint_%d", act->name.c_str(), i + 1);
+  }
+  act->tipName = act->name + "_tip";
+}
 int ServoInf::updateActuatorTF(UsarsimActuator *act, const sw_struct *sw, bool broadcastTF)
 {
   ros::Time currentTime;
   tf::Quaternion quat;
-  geometry_msgs::Quaternion quatMsg;
-  geometry_msgs::TransformStamped currentJointTf;  
-  std::stringstream tempSS;
   tf::Vector3 currentTipPosition; //relative to actuator base
   tf::Transform lastTipTransform; //relative to actuator base
   tf::Transform absoluteTransform;//relative to actuator base
+  int parent;
 
   currentTime = ros::Time::now ();
-  act->jointTf.clear();
-  currentJointTf.header.stamp = currentTime;
+  if (act->jointIndex.size () != (unsigned int) act->numJoints)
+    nameActuatorJoints (act, act->numJoints);
+  // one transform per link plus the tip, updated in place
+  act->jointTf.resize(act->numJoints + 1);
   
   setTransform(act, sw->data.actuator.mount, currentTime);
-  act->tf.child_frame_id = act->name + "_link0";
+  act->tf.child_frame_id = act->linkNames[0];
   if(broadcastTF)
-  	rosTfBroadcaster.sendTransform (act->tf);
+  	sendMountTransform (act);
+  else
+  	frames.set (act->tf);
   
   lastTipTransform.setOrigin(tf::Vector3(0,0,0));
   lastTipTransform.setRotation(tf::Quaternion(0,0,0,1));
@@ -755,12 +1257,14 @@ int ServoInf::updateActuatorTF(UsarsimActuator *act, const sw_struct *sw, bool b
   //  ROS_ERROR( "sent transform from \"%s\" to \"%s\"", act->tf.header.frame_id.c_str(), act->tf.child_frame_id.c_str() );
   for(int i = 0;i<act->numJoints;i++)
   {
-      tempSS.str("");
-      tempSS << i+1;
-      currentJointTf.child_frame_id = act->name + std::string("_link") + tempSS.str ();
-	  tempSS.str("");
-	  tempSS << sw->data.actuator.link[i].parent;
-	  currentJointTf.header.frame_id = act->name + std::string("_link") + tempSS.str ();
+      geometry_msgs::TransformStamped &currentJointTf = act->jointTf[i];
+      currentJointTf.header.stamp = currentTime;
+      currentJointTf.child_frame_id = act->linkNames[i+1];
+	  parent = sw->data.actuator.link[i].parent;
+	  if(parent >= 0 && parent <= act->numJoints)
+	    currentJointTf.header.frame_id = act->linkNames[parent];
+	  else
+	    currentJointTf.header.frame_id = scratch().printf("%s_link%d", act->name.c_str(), parent);
 	  
 	  //USARSim specifies link offsets in actuator coordinates and link rotations in link coordinates,
 	  //so we need to treat rotations and positions seperately when calculating link transforms.
@@ -782,19 +1286,17 @@ int ServoInf::updateActuatorTF(UsarsimActuator *act, const sw_struct *sw, bool b
 	  lastTipTransform *= relativeTransform;
 	  
 	  tf::transformTFToMsg(relativeTransform, currentJointTf.transform);
-      act->jointTf.push_back(currentJointTf);
+      // components mounted on this link are placed from it either way
       if(broadcastTF)
-      	rosTfBroadcaster.sendTransform(currentJointTf);
+      	sendTransform (currentJointTf);
+      else
+      	frames.set (currentJointTf);
   }
-  //add transformation for arm tip
-  if(!act->jointTf.empty())
-  {
-  	currentJointTf.header.frame_id = act->jointTf.back().child_frame_id;
-  }else
-  {
-    currentJointTf.header.frame_id = act->name + "_link0";
-  }
-  currentJointTf.child_frame_id = act->name + "_tip";
+  //add transformation for arm tip, which hangs off of the last link
+  geometry_msgs::TransformStamped &currentJointTf = act->jointTf[act->numJoints];
+  currentJointTf.header.stamp = currentTime;
+  currentJointTf.header.frame_id = act->linkNames[act->numJoints];
+  currentJointTf.child_frame_id = act->tipName;
   //find the position of the next link tip in the global coordinate frame
   tf::Vector3 tipOffset(sw->data.actuator.tip.x,sw->data.actuator.tip.y,sw->data.actuator.tip.z);
   currentTipPosition += tipOffset;
@@ -821,8 +1323,7 @@ int ServoInf::updateActuatorTF(UsarsimActuator *act, const sw_struct *sw, bool b
   tf::transformTFToMsg(relativeTransform, currentJointTf.transform);
   
   //tip transformation has no joint or link, so always publish it
-  rosTfBroadcaster.sendTransform (currentJointTf); 
-  act->jointTf.push_back(currentJointTf);
+  sendTransform (currentJointTf); 
    
   return 1;
 }
@@ -833,7 +1334,11 @@ ServoInf::copyGrdVehSettings (UsarsimGrdVeh * settings, const sw_struct * sw)
   // the platform name needs to be set to "base_link"
   // and we will need to change any sensor mounted to the 
   // platform to point to the "base_link"
-  settings->platformName = std::string (sw->name);
+  {
+    // setTransform reads it from every publish worker
+    UsarsimMutexLock lock (registryMutex);
+    settings->platformName = sw->name;
+  }
   //  settings->platformName = std::string ("base_link");
   settings->platformSize.x = sw->data.groundvehicle.length;
   settings->platformSize.y = sw->data.groundvehicle.width;
@@ -858,7 +1363,8 @@ ServoInf::copyStaticVehSettings (UsarsimPlatform * settings, const sw_struct * s
   // the platform name needs to be set to "base_link"
   // and we will need to change any sensor mounted to the 
   // platform to point to the "base_link"
-  settings->platformName = std::string (sw->name);
+  UsarsimMutexLock lock (registryMutex);
+  settings->platformName = sw->name;
   return 1;
 }
 
@@ -872,7 +1378,6 @@ ServoInf::copyIns (UsarsimOdomSensor * sen, const sw_struct * sw)
   ros::Time currentTime;
   tf::Quaternion quat;
   geometry_msgs::Quaternion quatMsg;
-  std::string sen_frame_id, sen_child_id;
   currentTime = ros::Time::now ();
 
 
@@ -896,17 +1401,8 @@ ServoInf::copyIns (UsarsimOdomSensor * sen, const sw_struct * sw)
 		 currentTime.toSec(), sw->time );
       basePlatform->tf.child_frame_id = "base_link";
       //  basePlatform->tf.child_frame_id = basePlatform->platformName.c_str ();
-      sen_child_id = std::string("base_footprint");
-      sen_frame_id = std::string("odom");
     }
-  else
-    {
-      sen_child_id = std::string("base_") + sen->name;
-      sen_frame_id = sen->name;
-      //sen_frame_id = std::string("odom");
-      //sen_child_id = sen->name;
-    }
-  // now set up the sensor
+  // now set up the sensor; its frame names were fixed by odomSensorIndex
   sen->tf.transform.translation.x = sw->data.ins.position.x;
   sen->tf.transform.translation.y = sw->data.ins.position.y;
   sen->tf.transform.translation.z = sw->data.ins.position.z;
@@ -915,14 +1411,10 @@ ServoInf::copyIns (UsarsimOdomSensor * sen, const sw_struct * sw)
 				      sw->data.ins.position.yaw);
   tf::quaternionTFToMsg (quat, quatMsg);
   sen->tf.transform.rotation = quatMsg;
-  sen->tf.child_frame_id = sen_child_id;
-  sen->tf.header.frame_id = sen_frame_id;
   sen->tf.header.stamp = currentTime;
 
   // odom message
   sen->odom.header.stamp = currentTime;
-  sen->odom.header.frame_id = sen->tf.header.frame_id;
-  sen->odom.child_frame_id = sen->tf.child_frame_id;
 
   // set the position
   sen->odom.pose.pose.position.x = sw->data.ins.position.x;
@@ -983,33 +1475,42 @@ ServoInf::copyRangeScanner (UsarsimRngScnSensor * sen, const sw_struct * sw)
   currentTime = ros::Time::now ();
   
   setTransform(sen, sw->data.rangescanner.mount, currentTime);
-  
-  sen->scan.header.stamp = currentTime;
-  //  sen->scan.header.frame_id = sen->tf.header.frame_id;
-  sen->scan.header.frame_id = sen->name;
-  sen->scan.angle_min =  -sw->data.rangescanner.fov / 2.;
-  sen->scan.angle_max =  sw->data.rangescanner.fov / 2.;
-  sen->scan.angle_increment = sw->data.rangescanner.resolution;
-  sen->scan.time_increment = 0;	// (1 / laser_frequency) / (num_readings);
-  sen->scan.range_min = sw->data.rangescanner.minrange;
-  sen->scan.range_max = sw->data.rangescanner.maxrange;
-
-  //  sen->scan.set_ranges_size((unsigned int)sw->data.rangescanner.number);
-  //  sen->scan.set_intensities_size((unsigned int)0);
-  sen->scan.ranges.clear();
-  sen->scan.intensities.clear();
+
+  // the mount is all the tf tree needs; the scan is only built when
+  // processMsg has sampled it for subscribers
+  if (!sen->wanted)
+    return 1;
+
+  // let go of the last scan first, so the pool can hand it out again
+  sen->scan.reset ();
+  sen->scan = sen->scanPool.take ();
+  sensor_msgs::LaserScan & scan = *sen->scan;
+  scan.header.stamp = currentTime;
+  scan.header.frame_id = sen->name;
+  scan.angle_min =  -sw->data.rangescanner.fov / 2.;
+  scan.angle_max =  sw->data.rangescanner.fov / 2.;
+  scan.angle_increment = sw->data.rangescanner.resolution;
+  scan.time_increment = 0;	// (1 / laser_frequency) / (num_readings);
+  scan.range_min = sw->data.rangescanner.minrange;
+  scan.range_max = sw->data.rangescanner.maxrange;
+
+  // resizing keeps the capacity the pooled scan had, so this only
+  // allocates when the scanner reports more readings than ever before
+  int number = sw->data.rangescanner.number;
+  scan.ranges.resize (number);
+  scan.intensities.clear();
   if( flipScanner )
     {
-      for (int i = sw->data.rangescanner.number-1; i>= 0; i--)
+      for (int i = 0; i < number; i++)
 	{
-	  sen->scan.ranges.push_back (sw->data.rangescanner.range[i]);
+	  scan.ranges[i] = sw->data.rangescanner.range[number - 1 - i];
 	}
     }
   else
     {
-      for (int i = 0; i < sw->data.rangescanner.number; i++)
+      for (int i = 0; i < number; i++)
 	{
-	  sen->scan.ranges.push_back (sw->data.rangescanner.range[i]);
+	  scan.ranges[i] = sw->data.rangescanner.range[i];
 	}
     }
   return 1;
@@ -1021,20 +1522,22 @@ int ServoInf::copyObjectSensor (UsarsimObjectSensor *sen, const sw_struct *sw)
   geometry_msgs::Quaternion quatMsg;
   currentTime = ros::Time::now ();
   setTransform(sen, sw->data.objectsensor.mount, currentTime);
+  if(!sen->wanted)
+    return 1;
   
   sen->objSense.header.stamp = currentTime;
-  sen->objSense.header.frame_id = sen->name;
   sen->objSense.fov = sw->data.objectsensor.fov;
-  sen->objSense.object_names.clear();
-  sen->objSense.material_names.clear();
-  sen->objSense.object_poses.clear();
-  sen->objSense.object_hit_locations.clear();
+  // the arrays and their strings are reused from the last sweep
+  sen->objSense.object_names.resize(sw->data.objectsensor.number);
+  sen->objSense.material_names.resize(sw->data.objectsensor.number);
+  sen->objSense.object_poses.resize(sw->data.objectsensor.number);
+  sen->objSense.object_hit_locations.resize(sw->data.objectsensor.number);
   for(int i = 0;i<sw->data.objectsensor.number;i++)
   {
-  	sen->objSense.object_names.push_back(std::string(sw->data.objectsensor.objects[i].tag));
-  	sen->objSense.material_names.push_back(std::string(sw->data.objectsensor.objects[i].material_name));
-  	geometry_msgs::Pose objectPose;
-  	geometry_msgs::Pose objectHitLocation;
+  	sen->objSense.object_names[i].assign(sw->data.objectsensor.objects[i].tag);
+  	sen->objSense.material_names[i].assign(sw->data.objectsensor.objects[i].material_name);
+  	geometry_msgs::Pose &objectPose = sen->objSense.object_poses[i];
+  	geometry_msgs::Pose &objectHitLocation = sen->objSense.object_hit_locations[i];
   	
   	objectPose.position.x = sw->data.objectsensor.objects[i].position.x;
   	objectPose.position.y = sw->data.objectsensor.objects[i].position.y;
@@ -1050,10 +1553,6 @@ int ServoInf::copyObjectSensor (UsarsimObjectSensor *sen, const sw_struct *sw)
   						
   	tf::quaternionTFToMsg(quat, quatMsg);
   	objectPose.orientation = quatMsg;
-  	
-  	sen->objSense.object_hit_locations.push_back(objectHitLocation);
-  	sen->objSense.object_poses.push_back(objectPose);
-  	
   }
   
   return 1;
@@ -1063,48 +1562,29 @@ int ServoInf::copyRangeImager(UsarsimRngImgSensor *sen, const sw_struct *sw)
 	ros::Time currentTime = ros::Time::now();
 	setTransform(sen, sw->data.rangeimager.mount, currentTime);
 	sen->opticalTransform.header.stamp = currentTime;
-	sen->depthImage.header.stamp = currentTime;
-	sen->depthImage.header.frame_id = sen->name + "_optical";
 	
-	sen->totalFrames = sw->data.rangeimager.totalframes;
-	sen->depthImage.encoding = sensor_msgs::image_encodings::TYPE_32FC1;
-	if(sen->totalFrames != 0)
+	if(sw->data.rangeimager.totalframes != 0)
 	{
-		//insert the current frame into a depth image
+		//copy the current frame into its slot of the depth image
+		sen->setGeometry((int)sw->data.rangeimager.resolutionx,
+				 (int)sw->data.rangeimager.resolutiony,
+				 sw->data.rangeimager.totalframes);
+		//decide at the start of each scan whether to assemble it, so a
+		//subscriber arriving mid scan does not leave a partial one
+		if(sw->data.rangeimager.frame == 0)
+			sen->assembling = sen->hasSubscribers();
+		if(sen->assembling)
+			sen->storeFrame(sw->data.rangeimager.frame,
+					sw->data.rangeimager.frame * sw->data.rangeimager.numberperframe,
+					sw->data.rangeimager.numberperframe,
+					sw->data.rangeimager.range);
 		sen->sentFrame(sw->data.rangeimager.frame);
-		sen->depthImage.height = sw->data.rangeimager.resolutiony;
-		sen->depthImage.width = sw->data.rangeimager.resolutionx;
-		sen->depthImage.step = sizeof(float)*sw->data.rangeimager.resolutionx;
-		sen->depthImage.data.reserve(sen->depthImage.step * sen->depthImage.height);
-		sen->depthImage.data.insert(sen->depthImage.data.begin() + (sw->data.rangeimager.frame * sw->data.rangeimager.numberperframe * sizeof(float)), 
-		    reinterpret_cast<const uint8_t*>(sw->data.rangeimager.range),
-		 	reinterpret_cast<const uint8_t*>(sw->data.rangeimager.range + sw->data.rangeimager.numberperframe));
+		if(sen->nextScan(sw->data.rangeimager.frame, ulapi_time()))
+			sen->sendScan();
 	}
-	//camera calibration data from the Kinect. 
-	//This will be scaled incorrectly if the camera's FOV is not the same as the Kinect's! (58x45 degrees)
-	sen->camInfo.header.frame_id = "/"+sen->name+"_optical";
-	sen->camInfo.height = sw->data.rangeimager.resolutiony;
-    sen->camInfo.width = sw->data.rangeimager.resolutionx;
-    float xScale = (float)sen->camInfo.width/640.0;
-    float yScale = (float)sen->camInfo.height/480.0;
-    sen->camInfo.distortion_model = "plumb_bob";
-    double dArray[] = {0.00000000, 0.00000000, 0.00000000, 0.00000000, 0.00000000};
-    double kArray[] = {585.05108211 * xScale, 0.00000000, 315.83800193 * xScale, 0.00000000, 585.05108211 * yScale, 242.94140713 * yScale, 0.00000000, 0.00000000, 1.00000000};
-    double rArray[] = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
-    double pArray[] = {585.05108211 * xScale, 0.00000000, 315.83800193 * xScale, 0.0, 0.00000000, 585.05108211 * yScale, 242.94140713 * yScale, 0.0, 0.00000000, 0.00000000, 1.00000000, 0.0};
-    
-    
-    sen->camInfo.D.assign(dArray, dArray+5);
-    std::copy(kArray, kArray+9, sen->camInfo.K.begin());
-    std::copy(rArray, rArray+9, sen->camInfo.R.begin());
-    std::copy(pArray, pArray+12, sen->camInfo.P.begin());
-    sen->camInfo.binning_x = 0;
-    sen->camInfo.binning_y = 0;
-    sen->camInfo.roi.x_offset = 0;
-    sen->camInfo.roi.y_offset = 0;
-    sen->camInfo.roi.height = 0;
-    sen->camInfo.roi.width = 0;
-    sen->camInfo.roi.do_rectify = false;
+	sen->setCameraInfo((int)sw->data.rangeimager.resolutionx,
+			   (int)sw->data.rangeimager.resolutiony,
+			   sw->data.rangeimager.fovx, sw->data.rangeimager.fovy);
 	return 1;
 }
 int ServoInf::copyGripperEffector(UsarsimGripperEffector * effector, const sw_struct *sw)
@@ -1174,9 +1654,8 @@ Set up the tf transformation for a component with the given pose
 */
 void ServoInf::setTransform(UsarsimSensor *sen, const sw_pose &pose, ros::Time currentTime)
 {
-  std::stringstream tempSS;
   tf::Quaternion quat;
-  tf::StampedTransform parentTransform;
+  tf::Transform parentTransform;
   tf::Transform absoluteTransform, relativeTransform;
   geometry_msgs::Quaternion quatMsg;
   quat = tf::createQuaternionFromRPY (pose.roll,
@@ -1184,55 +1663,47 @@ void ServoInf::setTransform(UsarsimSensor *sen, const sw_pose &pose, ros::Time c
 				      pose.yaw);
   tf::quaternionTFToMsg (quat, quatMsg);
 
-  sen->tf.transform.translation.x = pose.x;
-  sen->tf.transform.translation.y = pose.y;
-  sen->tf.transform.translation.z = pose.z;
-  sen->tf.transform.rotation = quatMsg;
+  //the mount is rebuilt on every message, but only goes out when it moved
+  geometry_msgs::Transform mount;
+  const char *frame;
+  mount.translation.x = pose.x;
+  mount.translation.y = pose.y;
+  mount.translation.z = pose.z;
+  mount.rotation = quatMsg;
   sen->tf.header.stamp = currentTime;
   sen->tf.child_frame_id = sen->name;
-  //if the object is mounted on the robot, mount it on base_link
-  if(!ulapi_strcasecmp(pose.offsetFrom, basePlatform->platformName.c_str()))
+  //if the object is mounted on the robot, mount it on base_link; worker 0
+  //may be renaming the platform, so compare under the registry lock
+  bool onRobot;
   {
-  	sen->tf.header.frame_id = "base_link";
-  }else if(!ulapi_strcasecmp (pose.offsetFrom, "HARD"))
-  {
-  	sen->tf.header.frame_id = "base_link";
+    UsarsimMutexLock lock (registryMutex);
+    onRobot = !ulapi_strcasecmp(pose.offsetFrom, basePlatform->platformName.c_str());
   }
+  if(!ulapi_strcasecmp (pose.offsetFrom, "HARD"))
+  	onRobot = true;
+  if(onRobot)
+  	frame = "base_link";
+  else if(pose.linkOffset < 0) //if no link is specified, mount the object directly on to its parent frame
+  	frame = pose.offsetFrom;
   else
   {
-  	if(pose.linkOffset < 0) //if no link is specified, mount the object directly on to its parent frame
-    	sen->tf.header.frame_id = pose.offsetFrom;
-    else
-    {
-    	//mount the object on its parent link frame and create a joint to publish it.
-    	tempSS.str("");
-    	tempSS<<pose.offsetFrom;
-    	tempSS<<"_link";
-    	tempSS<<pose.linkOffset;
-    	sen->tf.header.frame_id = tempSS.str();
-    	addJoint(sen->name + "_mount", 0.0);
-    }
-	bool success = false;
+  	//mount the object on its parent link frame and create a joint to publish it.
+  	frame = scratch().printf("%s_link%d", pose.offsetFrom, pose.linkOffset);
+  	if(sen->mountJoint < 0)
+  		sen->mountJoint = addJoint(sen->name + "_mount", 0.0);
+  }
+  if(sen->tf.header.frame_id != frame)
+  {
+  	sen->tf.header.frame_id = frame;
+  	sen->mountChanged = true;
+  }
+  if(!onRobot)
+  {
 	//get the transformation from the robot frame to this item's direct parent
-	try
-	{
-		tfListener.lookupTransform("base_link", sen->tf.header.frame_id, ros::Time(0), parentTransform);
-		success = true;
-	}catch(tf::LookupException e)
-	{
+	bool success = frames.lookup("base_link", sen->tf.header.frame_id, parentTransform);
+	if(!success)
 		ROS_DEBUG("%s: No transform for frame %s, skipping transform until one is available.", 
 		sen->name.c_str(), sen->tf.header.frame_id.c_str());
-	}
-	catch(tf::ConnectivityException e)
-	{
-		ROS_DEBUG("%s: No transform for frame %s, skipping transform until one is available.", 
-		sen->name.c_str(), sen->tf.header.frame_id.c_str());
-	}
-	catch(tf::ExtrapolationException e)
-	{
-		ROS_DEBUG("%s: No transform for frame %s, skipping transform until one is available.", 
-		sen->name.c_str(), sen->tf.header.frame_id.c_str());
-	}
 	if(success)
 	{
 		//find the relative transformation from the link frame to the object frame
@@ -1240,9 +1711,20 @@ void ServoInf::setTransform(UsarsimSensor *sen, const sw_pose &pose, ros::Time c
 		absoluteTransform.setRotation(quat);
 		
 		relativeTransform = parentTransform.inverseTimes(absoluteTransform);	    
-		tf::transformTFToMsg(relativeTransform, sen->tf.transform);
+		tf::transformTFToMsg(relativeTransform, mount);
 	}
   }
+  if(mount.translation.x != sen->tf.transform.translation.x
+     || mount.translation.y != sen->tf.transform.translation.y
+     || mount.translation.z != sen->tf.transform.translation.z
+     || mount.rotation.x != sen->tf.transform.rotation.x
+     || mount.rotation.y != sen->tf.transform.rotation.y
+     || mount.rotation.z != sen->tf.transform.rotation.z
+     || mount.rotation.w != sen->tf.transform.rotation.w)
+  {
+  	sen->tf.transform = mount;
+  	sen->mountChanged = true;
+  }
   sen->linkOffset = pose.linkOffset;  
 }
 
@@ -1254,30 +1736,38 @@ void ServoInf::setTransform(UsarsimSensor *sen, const sw_pose &pose, ros::Time c
 */
 /*
 Returns a pointer to the actuator with the given name. If the actuator with this name 
-does not exist, create and return it.
+does not exist, create and return it. Returns NULL if there is no room for another
+actuator.
 This behavior is DISTINCT from that of the other *Index functions.
+The trajectory server is not started here; see UsarsimActuator::ensureTrajectoryServer.
 */
 UsarsimActuator* 
-ServoInf::actuatorIn (std::list < UsarsimActuator > &actuatorsIn,
-			   std::string name)
+ServoInf::actuatorIn (std::vector < UsarsimActuator > &actuatorsIn,
+			   const std::string & name)
 {
-  std::list<UsarsimActuator>::iterator it;
-  std::string pubName;
-  UsarsimActuator newActuator(this);
+  UsarsimMutexLock lock (registryMutex);
   UsarsimActuator *actPtr;
   
-  for(it = actuatorsIn.begin();it != actuatorsIn.end();it++)
+  for(unsigned int t = 0; t < actuatorsIn.size(); t++)
   {
-  	if(it->name == name)
-  		return (UsarsimActuator*)(&*it);
+  	if(actuatorsIn[t].name == name)
+  		return &actuatorsIn[t];
   }
   
-  //unable to find the actuator, so must create it.
-  actuatorsIn.push_back (newActuator);
+  //unable to find the actuator, so must create it. Growing past the
+  //reserved capacity would move actuators that callbacks point at.
+  if(actuatorsIn.size() >= actuatorsIn.capacity())
+  {
+  	ROS_ERROR("servoInf: no room for actuator %s, limit is %d",
+  		name.c_str(), (int) actuatorsIn.capacity());
+  	return NULL;
+  }
+  actuatorsIn.push_back (UsarsimActuator(this));
   actPtr = &actuatorsIn.back();
   actPtr->name = name;
   actPtr->time = 0;
-  actPtr->setUpTrajectory();
+  actPtr->goalTolerance = trajectoryTolerance;
+  actPtr->goalTimeTolerance = trajectoryGoalTime;
   return actPtr;
 }
 
@@ -1285,8 +1775,8 @@ int
 ServoInf::odomSensorIndex (std::vector < UsarsimOdomSensor > &sensors,
 			   std::string name)
 {
+  UsarsimMutexLock lock (registryMutex);
   unsigned int t;
-  UsarsimOdomSensor newSensor;
   std::string pubName;
 
   for (t = 0; t < sensors.size (); t++)
@@ -1295,11 +1785,19 @@ ServoInf::odomSensorIndex (std::vector < UsarsimOdomSensor > &sensors,
 	return t;		// found it
     }
 
+  if (sensors.size () >= sensors.capacity ())
+    {
+      ROS_ERROR ("servoInf: no room for %s, limit is %d", name.c_str (),
+                 (int) sensors.capacity ());
+      return -1;
+    }
   ROS_INFO ("Adding sensor: %s", name.c_str ());
   if( odomName == std::string(""))
     odomName = name;
 
-  //unable to find the sensor, so must create it.
+  //unable to find the sensor, so must create it. Only now, since every
+  //sensor gets a mutex of its own
+  UsarsimOdomSensor newSensor;
   newSensor.name = name;
 
   newSensor.time = 0;
@@ -1309,9 +1807,21 @@ ServoInf::odomSensorIndex (std::vector < UsarsimOdomSensor > &sensors,
   else
     pubName = newSensor.name;
 
-  newSensor.pub = nh->advertise < nav_msgs::Odometry > (pubName.c_str (), 2);
-  newSensor.tf.header.frame_id = "base_link";
-  newSensor.tf.child_frame_id = newSensor.name.c_str ();
+  newSensor.pub = advertise < nav_msgs::Odometry > (pubName, &newSensor);
+  if (readRates (&newSensor))
+    newSensor.sidePub = advertise < nav_msgs::Odometry > (pubName + "_throttle", &newSensor);
+  if( name == odomName )
+    {
+      newSensor.tf.header.frame_id = "odom";
+      newSensor.tf.child_frame_id = "base_footprint";
+    }
+  else
+    {
+      newSensor.tf.header.frame_id = newSensor.name;
+      newSensor.tf.child_frame_id = std::string("base_") + newSensor.name;
+    }
+  newSensor.odom.header.frame_id = newSensor.tf.header.frame_id;
+  newSensor.odom.child_frame_id = newSensor.tf.child_frame_id;
 
 
   sensors.push_back (newSensor);
@@ -1322,8 +1832,8 @@ int
 ServoInf::rangeSensorIndex (std::vector < UsarsimRngScnSensor > &sensors,
 			    std::string name)
 {
+  UsarsimMutexLock lock (registryMutex);
   unsigned int t;
-  UsarsimRngScnSensor newSensor;
 
   for (t = 0; t < sensors.size (); t++)
     {
@@ -1331,12 +1841,21 @@ ServoInf::rangeSensorIndex (std::vector < UsarsimRngScnSensor > &sensors,
 	return t;		// found it
     }
 
+  if (sensors.size () >= sensors.capacity ())
+    {
+      ROS_ERROR ("servoInf: no room for %s, limit is %d", name.c_str (),
+                 (int) sensors.capacity ());
+      return -1;
+    }
   ROS_INFO ("Adding sensor: %s", name.c_str ());
 
-  //unable to find the sensor, so must create it.
+  //unable to find the sensor, so must create it
+  UsarsimRngScnSensor newSensor;
   newSensor.name = name;
   newSensor.time = 0;
-  newSensor.pub = nh->advertise < sensor_msgs::LaserScan > (name.c_str (), 2);
+  newSensor.pub = advertise < sensor_msgs::LaserScan > (name, &newSensor);
+  if (readRates (&newSensor))
+    newSensor.sidePub = advertise < sensor_msgs::LaserScan > (name + "_throttle", &newSensor);
   newSensor.tf.header.frame_id = "base_link";
   newSensor.tf.child_frame_id = name.c_str ();
 
@@ -1347,20 +1866,30 @@ int ServoInf::objectSensorIndex (std::vector < UsarsimObjectSensor > &sensors,
   	std::string name)
 {
 	unsigned int t;
-	UsarsimObjectSensor newSensor;
+	UsarsimMutexLock lock(registryMutex);
 	for (t = 0; t < sensors.size (); t++)
     {
       if (name == sensors[t].name)
 	return t;		// found it
     }
+    if (sensors.size () >= sensors.capacity ())
+      {
+        ROS_ERROR ("servoInf: no room for %s, limit is %d", name.c_str (),
+                   (int) sensors.capacity ());
+        return -1;
+      }
     ROS_INFO ("Adding sensor: %s", name.c_str ());
 
-  //unable to find the sensor, so must create it.
+  //unable to find the sensor, so must create it
+  UsarsimObjectSensor newSensor;
   newSensor.name = name;
   newSensor.time = 0;
-  newSensor.pub = nh->advertise < usarsim_inf::SenseObject > (name.c_str (), 2);
+  newSensor.pub = advertise < usarsim_inf::SenseObject > (name, &newSensor);
+  if (readRates (&newSensor))
+    newSensor.sidePub = advertise < usarsim_inf::SenseObject > (name + "_throttle", &newSensor);
   newSensor.tf.header.frame_id = "base_link";
   newSensor.tf.child_frame_id = name.c_str ();
+  newSensor.objSense.header.frame_id = name;
 
   sensors.push_back (newSensor);
   return sensors.size () - 1;
@@ -1368,41 +1897,101 @@ int ServoInf::objectSensorIndex (std::vector < UsarsimObjectSensor > &sensors,
 int ServoInf::rangeImagerIndex(std::vector < UsarsimRngImgSensor> &sensors, std::string name)
 {
 	unsigned int t;
+	UsarsimMutexLock lock(registryMutex);
 	for (t = 0; t < sensors.size (); t++)
     {
       if (name == sensors[t].name)
 	return t;		// found it
     }
+    if (sensors.size () >= sensors.capacity ())
+      {
+        ROS_ERROR ("servoInf: no room for %s, limit is %d", name.c_str (),
+                   (int) sensors.capacity ());
+        return -1;
+      }
     ROS_INFO("Adding sensor: %s",name.c_str());
     UsarsimRngImgSensor newSensor(this);
     sensors.push_back(newSensor);
     UsarsimRngImgSensor *sensePtr = &(sensors.back());
     sensePtr->name = name;
     sensePtr->time = 0;
-    sensePtr->pub = nh->advertise <sensor_msgs::Image > ("image_mono", 2);
+    sensePtr->pub = advertise <sensor_msgs::Image > ("image_mono", sensePtr);
     ROS_INFO("subscribing to topic %s",(sensePtr->name+"/command").c_str());
     sensePtr->command = nh->subscribe(sensePtr->name+"/command", 10, &UsarsimRngImgSensor::commandCallback, sensePtr);
-    sensePtr->cameraInfoPub = nh->advertise<sensor_msgs::CameraInfo >("camera_info",2);
+    sensePtr->cameraInfoPub = advertise<sensor_msgs::CameraInfo >("camera_info", sensePtr);
     sensePtr->tf.header.frame_id = "base_link";
     sensePtr->tf.child_frame_id = ("/"+name).c_str ();
     sensePtr->opticalTransform.header.frame_id = "/"+name;
     sensePtr->opticalTransform.child_frame_id = "/"+name+"_optical";
+    sensePtr->imageFrame = name + "_optical";
+    sensePtr->camInfo.header.frame_id = sensePtr->opticalTransform.child_frame_id;
     //create a transformation from the camera frame to the optical frame (image coordinates)
     tf::Quaternion quat;
     quat.setEuler(1.5707, 0, 1.5707);//yaw, pitch, roll 
     tf::quaternionTFToMsg(quat, sensePtr->opticalTransform.transform.rotation);
+    //optional continuous scanning, paced by the scan task
+    bool continuous;
+    nh->param<bool>("/usarsim/"+name+"/continuous", continuous, false);
+    if(continuous)
+    {
+	double rate, timeout;
+	int lead;
+	nh->param<double>("/usarsim/"+name+"/scanRate", rate, 0.);
+	nh->param<int>("/usarsim/"+name+"/scanLead", lead, 1);
+	nh->param<double>("/usarsim/"+name+"/scanTimeout", timeout, 2.);
+	ROS_INFO("RangeImager %s: scanning continuously, at most %.2f scans/s, next scan %d frames early",
+		 name.c_str(), rate, lead);
+	sensePtr->setContinuous(rate, lead, timeout);
+	//started with the first continuous imager, and shared by the rest
+	if(startScans() != 1)
+	  ROS_WARN("RangeImager %s: no scan task, so scans held back by scanRate or stalled scans will not be sent",
+		   name.c_str());
+    }
+    //optional strips, one per frame, with the camera info ROI saying which rows
+    bool strips;
+    nh->param<bool>("/usarsim/"+name+"/strips", strips, false);
+    if(strips)
+    {
+	//not counted as imager subscribers, strips need no scan assembled
+	sensePtr->stripPub = nh->advertise<sensor_msgs::Image>("image_mono_strip", 2);
+	sensePtr->stripInfoPub = nh->advertise<sensor_msgs::CameraInfo>("camera_info_strip", 2);
+    }
+    //optional point cloud, projected from each complete scan
+    bool cloud;
+    nh->param<bool>("/usarsim/"+name+"/cloud", cloud, false);
+    if(cloud)
+    {
+	double voxel;
+	bool depth;
+	nh->param<double>("/usarsim/"+name+"/cloudVoxel", voxel, 0.);
+	nh->param<bool>("/usarsim/"+name+"/cloudDepth", depth, false);
+	ROS_DEBUG("parameter /usarsim/%s/cloudVoxel: %f", name.c_str(), voxel);
+	sensePtr->cloud = new UsarsimCloud;
+	sensePtr->cloud->configure(voxel, depth);
+	//cloud subscribers count toward the imager's, so they get scans assembled too
+	sensePtr->cloud->pub = advertise<sensor_msgs::PointCloud2>("points", sensePtr);
+	if(sensePtr->cloud->start(name) != 1)
+	  ROS_WARN("unable to start the point cloud thread for %s, no points will be published", name.c_str());
+    }
     return sensors.size() - 1;
 }
 
 int ServoInf::gripperEffectorIndex(std::vector < UsarsimGripperEffector> &effectors, std::string name)
 {
 	unsigned int t;
+	UsarsimMutexLock lock(registryMutex);
 	
 	for (t = 0; t < effectors.size (); t++)
     {
       if (name == effectors[t].name)
 	return t;		// found it
     }
+    if (effectors.size () >= effectors.capacity ())
+      {
+        ROS_ERROR ("servoInf: no room for %s, limit is %d", name.c_str (),
+                   (int) effectors.capacity ());
+        return -1;
+      }
     ROS_INFO ("Adding effector: %s", name.c_str ());
   UsarsimGripperEffector newEffector(this);
   effectors.push_back (newEffector);
@@ -1410,7 +1999,9 @@ int ServoInf::gripperEffectorIndex(std::vector < UsarsimGripperEffector> &effect
   //unable to find the effector, so must create it.
   effectPtr->name = name;
   effectPtr->time = 0;
-  effectPtr->pub = nh->advertise < usarsim_inf::EffectorStatus > (name + "/status", 2);
+  // latched, since the status is only sent when it changes
+  effectPtr->pub = nh->advertise < usarsim_inf::EffectorStatus > (name + "/status", 2, true);
+  readHeartbeat (effectPtr);
   effectPtr->command = nh->subscribe(name+"/command",10,&UsarsimGripperEffector::commandCallback, effectPtr);
   effectPtr->tf.header.frame_id = "base_link"; // Mount this on the base_link until we get a geo message
   effectPtr->tf.child_frame_id = name.c_str ();
@@ -1420,12 +2011,19 @@ int ServoInf::gripperEffectorIndex(std::vector < UsarsimGripperEffector> &effect
 int ServoInf::toolchangerIndex(std::vector < UsarsimToolchanger> &effectors, std::string name)
 {
 	unsigned int t;
+	UsarsimMutexLock lock(registryMutex);
 	
 	for (t = 0; t < effectors.size (); t++)
     {
       if (name == effectors[t].name)
 	return t;		// found it
     }
+    if (effectors.size () >= effectors.capacity ())
+      {
+        ROS_ERROR ("servoInf: no room for %s, limit is %d", name.c_str (),
+                   (int) effectors.capacity ());
+        return -1;
+      }
     ROS_INFO ("Adding effector: %s", name.c_str ());
   UsarsimToolchanger newEffector(this);
   effectors.push_back (newEffector);
@@ -1433,7 +2031,9 @@ int ServoInf::toolchangerIndex(std::vector < UsarsimToolchanger> &effectors, std
   //unable to find the effector, so must create it.
   effectPtr->name = name;
   effectPtr->time = 0;
-  effectPtr->pub = nh->advertise < usarsim_inf::ToolchangerStatus > (name + "/status", 2);
+  // latched, since the status is only sent when it changes
+  effectPtr->pub = nh->advertise < usarsim_inf::ToolchangerStatus > (name + "/status", 2, true);
+  readHeartbeat (effectPtr);
   effectPtr->command = nh->subscribe(name+"/command",10,&UsarsimToolchanger::commandCallback, effectPtr);
   effectPtr->tf.header.frame_id = "base_link"; // Mount this on the base_link until we get a geo message
   effectPtr->tf.child_frame_id = name.c_str ();
@@ -1441,98 +2041,38 @@ int ServoInf::toolchangerIndex(std::vector < UsarsimToolchanger> &effectors, std
   return effectors.size () - 1;
 }
 /*
-Update the cycle time estimate for this actuator (used to time joint trajectory messages)
-*/
-void ServoInf::updateActuatorCycle(UsarsimActuator *act)
-{
-  ros::Time currentTime = ros::Time::now();
-  double currentCycle;
-  int dequeLength = act->cycleTimer.cycleDeque.size();
-  
-	// update cycle time with ctNow = ctOld - p0/n + pn/n
-  currentCycle = ros::Duration(currentTime - act->cycleTimer.lastTime).toSec();
-  act->cycleTimer.cycleTime = act->cycleTimer.cycleTime - act->cycleTimer.cycleDeque.front()/dequeLength + currentCycle/dequeLength;
-  act->cycleTimer.cycleDeque.push_back(currentCycle);
-  act->cycleTimer.cycleDeque.pop_front();
-  act->cycleTimer.lastTime = currentTime;
-}
-
-/*
-returns true if the trajectory has been completed, false 
-if it is still in progress
+Add a joint to the joints array if it hasn't already been added.
+Returns the index of the joint so that callers can cache it.
 */
-bool ServoInf::updateTrajectory(UsarsimActuator *act, const sw_struct *sw)
-{
-	TrajectoryPoint currentPoint;
-  ros::Time currentTime = ros::Time::now();
-  
-  if( act->currentTrajectory.goals.size() == 0 ) // check if done
-      return true;
-  currentPoint = act->currentTrajectory.goals.front();
-  // find next point to execute by looking at where we are likely to be the next time that this routine is called
-  currentTime += ros::Duration(act->cycleTimer.cycleTime);
-  while( currentPoint.time < currentTime )
-    {
-      act->currentTrajectory.goals.pop_front();
-      if( act->currentTrajectory.goals.size() == 0 )
-	  	break;
-      currentPoint = act->currentTrajectory.goals.front();
-    }
-    
-    sw_struct newSw;
-    newSw.type = SW_ROS_CMD_TRAJ;
-    newSw.name = sw->name;
-    newSw.data.roscmdtraj.number = currentPoint.numJoints;
-    for(unsigned int i = 0; i<currentPoint.numJoints; i++)
-    {
-	  // send next goal point to the robotic arm
-	  newSw.data.roscmdtraj.goal[i] = currentPoint.jointGoals[i];
-    }
-    sibling->peerMsg(&newSw);
-    
-    return false;
-  
-}
-/*
-returns true if the actuator is within the bounds of its goal
-*/
-bool ServoInf::checkTrajectoryGoal(UsarsimActuator *act, const sw_struct *sw)
-{
-	for(int i = 0;i<sw->data.actuator.number;i++)
-	  {
-	  if(abs(sw->data.actuator.link[i].position - act->currentTrajectory.finalGoal.jointGoals[i]) > 
-	     act->currentTrajectory.finalGoal.tolerances[i])
-	     {
-	    	return false;
-	     }
-	  }
-	  return true;
-}
-/*
-Add a joint to the joints array if it hasn't already been added
-*/
-void ServoInf::addJoint(std::string jointName, double jointValue)
+int ServoInf::addJoint(const std::string &jointName, double jointValue)
 {
+	UsarsimMutexLock lock(jointMutex);
 	for(unsigned int i = 0;i<joints.name.size();i++)
 	{
 		if(joints.name[i] == jointName)
 		{
 			joints.position[i] = jointValue;
-			return;
+			return i;
 		}
 	}
 	joints.name.push_back(jointName);
 	joints.position.push_back(jointValue);
+	return joints.name.size() - 1;
 }
 /*
-Publish all of the joint angles
+Publish all of the joint angles, once this thread's batch is done
 */
 void ServoInf::publishJoints()
 {
+	scratchSpace().jointsDirty = true;
+}
+void ServoInf::sendJoints()
+{
+	UsarsimMutexLock lock(jointMutex);
 	ros::Time currentTime = ros::Time::now();
 	joints.header.frame_id = "base_link";
 	joints.header.stamp = currentTime;
-	jointPublisher.publish(joints);
+	publish (jointPublisher, joints);
 }
 void *
   ServoInf::servoSetMutex = NULL;
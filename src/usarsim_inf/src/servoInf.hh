@@ -32,18 +32,37 @@
 
 #include <ros/ros.h>
 #include <tf/transform_broadcaster.h>
-#include <tf/transform_listener.h>
+#include <tf2_ros/static_transform_broadcaster.h>
+#include <tf2_msgs/TFMessage.h>
 #include <nav_msgs/Odometry.h>
 #include <sensor_msgs/LaserScan.h>
 #include <sensor_msgs/Image.h>
+#include <std_srvs/Empty.h>
 #include "genericInf.hh"
 #include "simware.hh"
 #include "usarsimInf.hh"
+#include "usarsimAlloc.hh"
+#include "usarsimFrames.hh"
+#include <boost/thread/tss.hpp>
+#include <boost/bind.hpp>
 
 
 ////////////////////////////////////////////////////////////////
 // structures
 ////////////////////////////////////////////////////////////////
+#define SERVO_ACTUATOR_MAX 16	/*!< how many actuators a robot can have */
+#define SERVO_COMPONENT_MAX 32	/*!< how many sensors or effectors of one kind */
+
+//! per publish thread scratch space, see ServoInf::peerMsg
+typedef struct
+{
+  UsarsimArena arena;
+  UsarsimAllocProbe probe;
+  //! transforms and joint state waiting for peerFlush
+  tf2_msgs::TFMessage tfBatch;
+  unsigned int tfCount;		// entries of tfBatch in use
+  bool jointsDirty;
+} ServoScratch;
 
 
 ////////////////////////////////////////////////////////////////
@@ -56,13 +75,16 @@ public:
   enum servoMutex
   {
     SERVO_SET_KEY = 101,
-    SERVO_STAT_KEY
+    SERVO_STAT_KEY,
+    SERVO_REGISTRY_KEY,
+    SERVO_JOINT_KEY,
+    SERVO_STATIC_KEY
   };
 
     ServoInf ();
    ~ServoInf ();
-  std::list<UsarsimActuator>::iterator getActuatorBegin();
-  std::list<UsarsimActuator>::iterator getActuatorEnd();
+  std::vector<UsarsimActuator>::iterator getActuatorBegin();
+  std::vector<UsarsimActuator>::iterator getActuatorEnd();
   //const UsarsimActuator *getActuator(unsigned int num);
   //unsigned int getNumActuators();
   unsigned int getNumExtras();
@@ -71,31 +93,115 @@ public:
   const geometry_msgs::Vector3 getPlatformSize();
   int init (GenericInf * siblingIn);
   int msgOut ();
+  //! subscribe to the commands, then serve every callback until shutdown
   int msgIn ();
+  //! subscribe to the commands; their callbacks are served by whoever
+  //! spins the node handle's queue
+  void subscribeCommands ();
   int peerMsg (sw_struct * sw);
+  int peerFlush ();
   void setBuildingTFTree();
+  //! start the task that samples actuator trajectories
+  int startTrajectories ();
+  void stopTrajectories ();
+  //! body of the trajectory task
+  void runTrajectories ();
+  //! start the task that paces continuous range imager scans
+  int startScans ();
+  void stopScans ();
+  //! body of the scan task
+  void runScans ();
+  //! stop the point cloud threads, once nothing publishes any more
+  void stopClouds ();
 private:
   bool buildTFTree; //whether or not the TF tree should be built. If false, rely on the robot_state_publisher node for some tf broadcasting.
   std::string odomName;
   static void *servoSetMutex;
   //  ros::Rate *loopRate;
-  ros::NodeHandle n;
-  tf::TransformListener tfListener;
+  ros::Subscriber velSub;
+  //! where every frame we know of sits, for mounting components on
+  //! other components without a tf listener
+  UsarsimFrameGraph frames;
   sensor_msgs::JointState joints; //joint state for the entire robot
   ros::Publisher jointPublisher;
+  ros::ServiceServer dumpStatsService;
+  bool dumpStatsCallback (std_srvs::Empty::Request & req,
+			  std_srvs::Empty::Response & res);
+  //! peerMsg may run on several publish threads at once, one component
+  //! per thread. Each thread gets its own scratch arena and allocation probe.
+  boost::thread_specific_ptr < ServoScratch > threadScratch;
+  ServoScratch & scratchSpace ();
+  //! scratch memory for per-message temporaries, reset by peerMsg
+  UsarsimArena & scratch ()
+  {
+    return scratchSpace ().arena;
+  }
+  bool reportAllocs;
+  void *trajectoryTask;
+  int trajectoryRunning;
+  void *scanTask;
+  int scanRunning;
+  double trajectoryTolerance;	// /usarsim/goalTolerance
+  double trajectoryGoalTime;	// /usarsim/goalTimeTolerance
+  //! protects the component vectors while a component is looked up or
+  //! added, and basePlatform->platformName
+  void *registryMutex;
+  //! protects joints, which collects joints from every component
+  void *jointMutex;
   
   UsarsimPlatform *basePlatform;
   UsarsimGrdVeh grdVehSettings;
   UsarsimSensor sensorSettings;
   
   void setTransform(UsarsimSensor *sen, const sw_pose &pose, ros::Time currentTime);
-  void addJoint(std::string jointName, double jointValue);
+  int addJoint(const std::string &jointName, double jointValue);
+  void nameActuatorJoints(UsarsimActuator *act, int number);
+  //! joint state goes out once, at the next peerFlush
   void publishJoints();
+  void sendJoints();
+  int processMsg (sw_struct * sw);
+  //! publish outside of the allocation accounting; roscpp owns those buffers
+  template < class M > void publish (ros::Publisher & pub, const M & msg)
+  {
+    UsarsimAllocPause pause;
+    pub.publish (msg);
+  }
+  //! publish without a copy; msg must not change once it is published
+  template < class M > void publish (ros::Publisher & pub,
+				     const boost::shared_ptr < M > &msg)
+  {
+    UsarsimAllocPause pause;
+    pub.publish (boost::shared_ptr < const M > (msg));
+  }
+  //! advertise topic for sen, counting its subscribers in sen->subscribers
+  template < class M > ros::Publisher advertise (const std::string & topic,
+						 UsarsimSensor * sen)
+  {
+    return nh->advertise < M > (topic, 2,
+				boost::bind (&UsarsimSensor::countSubscriber,
+					     sen->subscribers, 1, _1),
+				boost::bind (&UsarsimSensor::countSubscriber,
+					     sen->subscribers, -1, _1));
+  }
+  //! read sen's publish rate parameters; true if it wants a side topic
+  bool readRates (UsarsimSensor * sen);
+  //! read how often sen's status goes out when it does not change
+  void readHeartbeat (UsarsimSensor * sen);
+  void sendTransform (const geometry_msgs::TransformStamped & tf);
+  void sendStaticTransform (const geometry_msgs::TransformStamped & tf);
+  bool sendMountTransform (UsarsimSensor * sen);
   
   //! We will always need a transform
-  tf::TransformBroadcaster rosTfBroadcaster;
-  //! Actuators
-  std::list < UsarsimActuator > actuators;
+  //! /tf, one TFMessage per peerFlush
+  ros::Publisher tfPublisher;
+  //! mounts and other constant transforms, latched on /tf_static
+  tf2_ros::StaticTransformBroadcaster staticBroadcaster;
+  //! everything sent on /tf_static so far, guarded by staticMutex
+  std::vector < geometry_msgs::TransformStamped > staticTransforms;
+  void *staticMutex;
+  //! Actuators. Reserved to SERVO_ACTUATOR_MAX at construction and never
+  //! reallocated, since the action server callbacks hold pointers into it.
+  std::vector < UsarsimActuator > actuators;
   //! Odometry sensors 
   std::vector < UsarsimOdomSensor > odometers;
   //! Range scanner sensors
@@ -108,8 +214,8 @@ private:
   std::vector < UsarsimToolchanger > toolchangers;
   //! Range imager sensors
   std::vector < UsarsimRngImgSensor > rangeImagers;
-  UsarsimActuator* actuatorIn (std::list < UsarsimActuator > &actuatorsIn,
-		     std::string name);
+  UsarsimActuator* actuatorIn (std::vector < UsarsimActuator > &actuatorsIn,
+		     const std::string & name);
   int odomSensorIndex (std::vector < UsarsimOdomSensor > &sensors,
 		       std::string name);
   int rangeSensorIndex (std::vector < UsarsimRngScnSensor > &sensors,
@@ -133,9 +239,6 @@ private:
   int copyRangeImager (UsarsimRngImgSensor * sen, const sw_struct * sw);
   void VelCmdCallback (const geometry_msgs::TwistConstPtr & msg);
   int updateActuatorTF(UsarsimActuator *act, const sw_struct *sw, bool broadcastTF);
-  void updateActuatorCycle(UsarsimActuator *act);
-  bool updateTrajectory(UsarsimActuator *act, const sw_struct *sw);
-  bool checkTrajectoryGoal(UsarsimActuator *act, const sw_struct *sw);
   
 };
 
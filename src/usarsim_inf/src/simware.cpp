@@ -17,6 +17,10 @@
 */
 
 #include <stdio.h>		// sprintf
+#include <stdlib.h>		// malloc
+#include <string.h>		// memcpy
+#include <pthread.h>
+#include <vector>
 #include "simware.hh"
 
 const char *
@@ -91,3 +95,64 @@ swTypeToString (sw_type type)
 
   return retstr;
 }
+
+/*
+  Payload pool. Buffers are handed out in power of two sizes, and released
+  buffers go onto a free list for their size so that the next sensor (or
+  the next resize) can take them without going back to malloc.
+*/
+#define SW_POOL_CLASSES 40
+static std::vector < void *>swPool[SW_POOL_CLASSES];
+static pthread_mutex_t swPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+swPoolClass (size_t bytes)
+{
+  int poolClass = 6;		// nothing smaller than 64 bytes
+
+  while (((size_t) 1 << poolClass) < bytes && poolClass < SW_POOL_CLASSES - 1)
+    poolClass++;
+  return poolClass;
+}
+
+int
+swPayloadReserve (void **buf, int *capacity, int needed, size_t elemSize)
+{
+  void *newBuf;
+  int poolClass;
+
+  if (needed <= *capacity)
+    return 1;
+  poolClass = swPoolClass (needed * elemSize);
+  pthread_mutex_lock (&swPoolMutex);
+  if (swPool[poolClass].empty ())
+    newBuf = NULL;
+  else
+    {
+      newBuf = swPool[poolClass].back ();
+      swPool[poolClass].pop_back ();
+    }
+  pthread_mutex_unlock (&swPoolMutex);
+  if (newBuf == NULL)
+    newBuf = malloc ((size_t) 1 << poolClass);
+  if (newBuf == NULL)
+    return 0;
+  if (*buf != NULL)
+    memcpy (newBuf, *buf, *capacity * elemSize);
+  swPayloadRelease (buf, capacity, elemSize);
+  *buf = newBuf;
+  *capacity = ((size_t) 1 << poolClass) / elemSize;
+  return 1;
+}
+
+void
+swPayloadRelease (void **buf, int *capacity, size_t elemSize)
+{
+  if (*buf == NULL)
+    return;
+  pthread_mutex_lock (&swPoolMutex);
+  swPool[swPoolClass (*capacity * elemSize)].push_back (*buf);
+  pthread_mutex_unlock (&swPoolMutex);
+  *buf = NULL;
+  *capacity = 0;
+}
@@ -233,13 +233,13 @@ enum
   SW_SEN_RANGEIMAGER_STAT = 1,
   SW_SEN_RANGEIMAGER_SET
 };
-#define SW_SEN_RANGEIMAGER_MAX 6000
 typedef struct
 {
   int frame;			/*!< Frame number (out of totalframes), frames must break on a line boundary */
   int totalframes;		/*!< Total number of frames */
   int numberperframe;		/*!< how many elements in this message  */
-  float range[SW_SEN_RANGEIMAGER_MAX];
+  float *range;			/*!< payload buffer, see swPayloadReserve */
+  int capacity;			/*!< how many ranges fit in range */
   double maxrange;
   double minrange;
   double resolutionx;
@@ -255,10 +255,10 @@ enum
   SW_SEN_RANGESCANNER_STAT = 1,
   SW_SEN_RANGESCANNER_SET
 };
-#define SW_SEN_RANGESCANNER_MAX 192	/*!< how many ranges we can have  */
 typedef struct
 {
-  double range[SW_SEN_RANGESCANNER_MAX];
+  double *range;		/*!< payload buffer, see swPayloadReserve */
+  int capacity;			/*!< how many ranges fit in range */
   double maxrange;
   double minrange;
   double resolution;
@@ -383,9 +383,11 @@ enum
 	SW_SEN_OBJECTSENSOR_STAT = 1,
 	SW_SEN_OBJECTSENSOR_SET
 };
+#define SW_SEN_OBJECTSENSOR_INITIAL 16	/*!< objects reserved when a sensor is configured */
 typedef struct
 {
-  sw_sen_object_struct objects[SW_SEN_RANGESCANNER_MAX];
+  sw_sen_object_struct *objects;	/*!< payload buffer, see swPayloadReserve */
+  int capacity;			/*!< how many objects fit in objects */
   sw_pose mount;
   double fov;
   int number; //the number of objects detected by the sensor
@@ -478,9 +480,21 @@ typedef struct
 {
   int dummy;
 } sw_ros_cmd_scan_struct;
+/*!
+  When a message from the simulator passed each stage of the bridge, in
+  ulapi_monotime seconds. received is 0 unless tracing is on.
+*/
+typedef struct
+{
+  double received;		/*!< first bytes of its line were read */
+  double framed;		/*!< the line delimiter was read */
+  double parsed;		/*!< parsing finished */
+  double peer;			/*!< handed to the sibling's peerMsg */
+} sw_trace;
 typedef struct
 {
   double time;
+  sw_trace trace;
   sw_type type;			/*!< Which resource is selected. */
   sw_op op;			/*!< What operation to do on the resource.  */
   std::string name;		/*!< Resources are identified by string names. */
@@ -523,4 +537,18 @@ typedef struct
 
 extern const char *swTypeToString (sw_type type);
 extern const char *swRobotType (ROBOT_TYPE type);
+
+/*!
+  Make room for at least \a needed elements of \a elemSize bytes in the
+  payload buffer \a *buf, which currently holds \a *capacity elements.
+  Existing contents are kept. Buffers come from a process-wide pool and
+  released buffers are reused, so a sensor only pays for what its
+  configuration asks for. Returns 1, or 0 if memory ran out.
+*/
+extern int swPayloadReserve (void **buf, int *capacity, int needed,
+			     size_t elemSize);
+//! Return a payload buffer to the pool
+extern void swPayloadRelease (void **buf, int *capacity, size_t elemSize);
+#define SW_PAYLOAD_RESERVE(ARRAY, CAPACITY, NEEDED) \
+  swPayloadReserve ((void **) &(ARRAY), &(CAPACITY), (NEEDED), sizeof (*(ARRAY)))
 #endif
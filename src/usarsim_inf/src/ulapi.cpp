@@ -28,10 +28,14 @@
 #include <string.h>		/* memset */
 #include <ctype.h>		/* isspace */
 #include <pthread.h>		/* pthread_create(), pthread_mutex_t */
+#include <sched.h>		/* SCHED_FIFO, cpu_set_t */
 #include <time.h>		/* struct timespec, nanosleep */
 #include <sys/time.h>		/* gettimeofday(), struct timeval */
-#include <unistd.h>		/* select(), write() */
+#include <unistd.h>		/* select(), write(), syscall() */
+#include <sys/syscall.h>	/* SYS_futex */
+#include <linux/futex.h>	/* FUTEX_WAIT_PRIVATE */
 #include <sys/sem.h>
+#include <semaphore.h>		/* sem_init(), sem_wait() */
 #include <errno.h>
 #include <fcntl.h>		/* O_RDONLY, O_NONBLOCK */
 #include <sys/types.h>		/* fd_set, FD_ISSET() */
@@ -192,53 +196,236 @@ ulapi_socket_get_client_id (ulapi_integer port, const char *hostname)
   return socket_fd;
 }
 
-ulapi_result
-ulapi_mutex_delete (void *mutex)
+/*
+  The mutex is a futex word: 0 free, 1 held, 2 held with sleepers
+  (Drepper, "Futexes Are Tricky"). A take that finds it held first
+  spins for about as long as recent contended takes needed, so short
+  critical sections never reach the kernel. The counters are only
+  written by the holder, so they need no lock of their own.
+*/
+#define UNIX_MUTEX_SPIN_MAX 100
+
+typedef struct unix_mutex_struct
 {
-  if (NULL == (void *) mutex)
-    return ULAPI_ERROR;
+  int state;
+  int spin;			/* running estimate of a useful spin */
+  ulapi_id key;
+  char name[32];
+  ulapi_mutex_stats stats;
+  struct unix_mutex_struct *next;
+} unix_mutex_struct;
 
-  (void) pthread_mutex_destroy ((pthread_mutex_t *) mutex);
-  free (mutex);
+static pthread_mutex_t unix_mutex_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static unix_mutex_struct *unix_mutex_list = NULL;
 
-  return ULAPI_OK;
+static inline void
+unix_cpu_relax (void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+  __asm__ __volatile__ ("pause");
+#endif
+}
+
+static void
+unix_futex_wait (int *addr, int val)
+{
+  syscall (SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void
+unix_futex_wake (int *addr)
+{
+  syscall (SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static double
+unix_monotonic (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
 }
 
 void *
 ulapi_mutex_new (ulapi_id key)
 {
-  pthread_mutex_t *mutex;
+  unix_mutex_struct *mutex;
 
-  mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+  mutex = (unix_mutex_struct *) malloc (sizeof (unix_mutex_struct));
   if (NULL == (void *) mutex)
     return NULL;
 
-  /* initialize mutex to default attributes, and give it */
-  if (0 == pthread_mutex_init (mutex, NULL))
+  /* mutexes start out given */
+  memset (mutex, 0, sizeof (unix_mutex_struct));
+  mutex->key = key;
+  pthread_mutex_lock (&unix_mutex_list_lock);
+  mutex->next = unix_mutex_list;
+  unix_mutex_list = mutex;
+  pthread_mutex_unlock (&unix_mutex_list_lock);
+
+  return (void *) mutex;
+}
+
+ulapi_result
+ulapi_mutex_delete (void *mutex)
+{
+  unix_mutex_struct **ptr;
+
+  if (NULL == mutex)
+    return ULAPI_ERROR;
+
+  pthread_mutex_lock (&unix_mutex_list_lock);
+  for (ptr = &unix_mutex_list; *ptr != NULL; ptr = &(*ptr)->next)
     {
-      (void) pthread_mutex_unlock (mutex);
-      return (void *) mutex;
+      if (*ptr == mutex)
+	{
+	  *ptr = (*ptr)->next;
+	  break;
+	}
     }
-  /* else got an error, so free the mutex and return null */
-
+  pthread_mutex_unlock (&unix_mutex_list_lock);
   free (mutex);
-  return NULL;
+
+  return ULAPI_OK;
+}
+
+ulapi_result
+ulapi_mutex_set_name (void *mutex, const char *name)
+{
+  if (NULL == mutex || NULL == name)
+    return ULAPI_BAD_ARGS;
+  ulapi_strncpy (((unix_mutex_struct *) mutex)->name, name,
+		 sizeof (((unix_mutex_struct *) mutex)->name) - 1);
+
+  return ULAPI_OK;
 }
 
 ulapi_result
 ulapi_mutex_give (void *mutex)
 {
-  return (0 ==
-	  pthread_mutex_unlock ((pthread_mutex_t *) mutex) ? ULAPI_OK :
-	  ULAPI_ERROR);
+  unix_mutex_struct *m = (unix_mutex_struct *) mutex;
+
+  if (NULL == m)
+    return ULAPI_ERROR;
+  if (__atomic_fetch_sub (&m->state, 1, __ATOMIC_RELEASE) != 1)
+    {
+      /* someone may be asleep on it */
+      __atomic_store_n (&m->state, 0, __ATOMIC_RELEASE);
+      unix_futex_wake (&m->state);
+    }
+
+  return ULAPI_OK;
 }
 
 ulapi_result
 ulapi_mutex_take (void *mutex)
 {
-  return (0 ==
-	  pthread_mutex_lock ((pthread_mutex_t *) mutex) ? ULAPI_OK :
-	  ULAPI_ERROR);
+  unix_mutex_struct *m = (unix_mutex_struct *) mutex;
+  int expected = 0;
+  int spins;
+  int max_spin;
+  int c;
+  double start;
+  double wait;
+
+  if (NULL == m)
+    return ULAPI_ERROR;
+  if (__atomic_compare_exchange_n (&m->state, &expected, 1, 0,
+				   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      m->stats.acquisitions++;
+      return ULAPI_OK;
+    }
+
+  start = unix_monotonic ();
+  max_spin = 2 * __atomic_load_n (&m->spin, __ATOMIC_RELAXED) + 10;
+  if (max_spin > UNIX_MUTEX_SPIN_MAX)
+    max_spin = UNIX_MUTEX_SPIN_MAX;
+  for (spins = 0; spins < max_spin; spins++)
+    {
+      unix_cpu_relax ();
+      expected = 0;
+      if (__atomic_load_n (&m->state, __ATOMIC_RELAXED) == 0
+	  && __atomic_compare_exchange_n (&m->state, &expected, 1, 0,
+					  __ATOMIC_ACQUIRE,
+					  __ATOMIC_RELAXED))
+	break;
+    }
+  if (spins == max_spin)
+    {
+      /* still held; mark it contended and sleep until given */
+      c = __atomic_exchange_n (&m->state, 2, __ATOMIC_ACQUIRE);
+      while (c != 0)
+	{
+	  unix_futex_wait (&m->state, 2);
+	  c = __atomic_exchange_n (&m->state, 2, __ATOMIC_ACQUIRE);
+	}
+    }
+  /* same running average glibc uses for its adaptive mutexes */
+  m->spin += (spins - m->spin) / 8;
+
+  wait = unix_monotonic () - start;
+  m->stats.acquisitions++;
+  m->stats.contended++;
+  m->stats.wait_total += wait;
+  if (wait > m->stats.wait_max)
+    m->stats.wait_max = wait;
+
+  return ULAPI_OK;
+}
+
+ulapi_result
+ulapi_mutex_get_stats (void *mutex, ulapi_mutex_stats * stats)
+{
+  if (NULL == mutex || NULL == stats)
+    return ULAPI_BAD_ARGS;
+  *stats = ((unix_mutex_struct *) mutex)->stats;
+
+  return ULAPI_OK;
+}
+
+static void
+unix_mutex_log (const char *name, ulapi_id key, const ulapi_mutex_stats * st)
+{
+  ROS_INFO ("ulapi mutex %s (key %ld): %ld takes, %ld contended (%.1f%%), "
+	    "waited %.6f s total, %.6f s max",
+	    name, (long) key, (long) st->acquisitions, (long) st->contended,
+	    st->acquisitions ? 100. * st->contended / st->acquisitions : 0.,
+	    (double) st->wait_total, (double) st->wait_max);
+}
+
+void
+ulapi_mutex_dump_stats (void)
+{
+  unix_mutex_struct *m;
+  ulapi_mutex_stats unnamed;
+  int unnamed_count = 0;
+
+  memset (&unnamed, 0, sizeof (unnamed));
+  pthread_mutex_lock (&unix_mutex_list_lock);
+  for (m = unix_mutex_list; m != NULL; m = m->next)
+    {
+      if (m->name[0] != 0)
+	{
+	  unix_mutex_log (m->name, m->key, &m->stats);
+	  continue;
+	}
+      unnamed_count++;
+      unnamed.acquisitions += m->stats.acquisitions;
+      unnamed.contended += m->stats.contended;
+      unnamed.wait_total += m->stats.wait_total;
+      if (m->stats.wait_max > unnamed.wait_max)
+	unnamed.wait_max = m->stats.wait_max;
+    }
+  pthread_mutex_unlock (&unix_mutex_list_lock);
+  if (unnamed_count)
+    {
+      char name[32];
+
+      ulapi_snprintf (name, sizeof (name), "<%d unnamed>", unnamed_count);
+      unix_mutex_log (name, 0, &unnamed);
+    }
 }
 
 ulapi_result
@@ -247,6 +434,12 @@ ulapi_socket_close (ulapi_integer id)
   return 0 == close ((int) id) ? ULAPI_OK : ULAPI_ERROR;
 }
 
+ulapi_result
+ulapi_socket_shutdown_read (ulapi_integer id)
+{
+  return 0 == shutdown ((int) id, SHUT_RD) ? ULAPI_OK : ULAPI_ERROR;
+}
+
 ulapi_result
 ulapi_exit (void)
 {
@@ -283,10 +476,47 @@ ulapi_prio_next_lower (ulapi_prio prio)
   return prio + 1;
 }
 
+/*
+  A task is its thread plus what the thread needs to know about itself
+  when it starts: where to run, under which policy, and, for periodic
+  tasks, the period and the next absolute deadline. The thread finds
+  its own task through unix_self_task; threads not started through
+  ulapi (main, say) get one of their own on their first ulapi_wait.
+*/
+typedef struct
+{
+  pthread_t thread;
+  void (*code) (void *);
+  void *arg;
+  ulapi_prio prio;
+  ulapi_integer cpu;		/* -1 means any */
+  ulapi_flag fifo;
+  ulapi_integer period_nsec;	/* 0 means not periodic */
+  int deadline_set;
+  struct timespec deadline;	/* CLOCK_MONOTONIC */
+  ulapi_task_stats stats;
+} unix_task_struct;
+
+static __thread unix_task_struct *unix_self_task = NULL;
+
+static void
+unix_task_init_struct (unix_task_struct * task)
+{
+  memset (task, 0, sizeof (unix_task_struct));
+  task->prio = ulapi_prio_lowest ();
+  task->cpu = -1;
+}
+
 void *
 ulapi_task_new (void)
 {
-  return malloc (sizeof (pthread_t));
+  unix_task_struct *task;
+
+  task = (unix_task_struct *) malloc (sizeof (unix_task_struct));
+  if (NULL != task)
+    unix_task_init_struct (task);
+
+  return (void *) task;
 }
 
 ulapi_result
@@ -298,32 +528,110 @@ ulapi_task_delete (void *task)
   return ULAPI_OK;
 }
 
-typedef void *(*pthread_task_code) (void *);
+ulapi_result
+ulapi_task_set_cpu (void *task, ulapi_integer cpu)
+{
+  if (NULL == task || cpu < -1 || cpu >= CPU_SETSIZE)
+    return ULAPI_BAD_ARGS;
+  ((unix_task_struct *) task)->cpu = cpu;
+
+  return ULAPI_OK;
+}
+
+ulapi_result
+ulapi_task_set_fifo (void *task, ulapi_flag fifo)
+{
+  if (NULL == task)
+    return ULAPI_BAD_ARGS;
+  ((unix_task_struct *) task)->fifo = fifo;
+
+  return ULAPI_OK;
+}
+
+/*
+  ulapi priorities run from 1 (highest) to 31 (lowest); SCHED_FIFO
+  priorities run the other way, so count down from the top of its range.
+*/
+static int
+unix_fifo_prio (ulapi_prio prio)
+{
+  int max = sched_get_priority_max (SCHED_FIFO);
+  int min = sched_get_priority_min (SCHED_FIFO);
+  int fifo_prio = max - (prio - ulapi_prio_highest ());
+
+  return fifo_prio < min ? min : fifo_prio;
+}
+
+/*
+  Runs on the new thread: apply the placement and policy, which only
+  take effect from inside the thread once it exists, then run the task.
+*/
+static void *
+unix_task_wrapper (void *arg)
+{
+  unix_task_struct *task = (unix_task_struct *) arg;
+  struct sched_param sched_param;
+  cpu_set_t cpus;
+  int err;
+
+  unix_self_task = task;
+  if (task->cpu >= 0)
+    {
+      CPU_ZERO (&cpus);
+      CPU_SET (task->cpu, &cpus);
+      err = pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus);
+      if (0 != err)
+	ROS_WARN ("ulapi: can't pin task to cpu %d: %s", (int) task->cpu,
+		  strerror (err));
+    }
+  if (task->fifo)
+    {
+      sched_param.sched_priority = unix_fifo_prio (task->prio);
+      err = pthread_setschedparam (pthread_self (), SCHED_FIFO, &sched_param);
+      if (0 != err)
+	ROS_WARN ("ulapi: can't run task as SCHED_FIFO %d: %s",
+		  sched_param.sched_priority, strerror (err));
+    }
+  task->code (task->arg);
+
+  return NULL;
+}
 
 ulapi_result
 ulapi_task_start (void *task,
 		  void (*taskcode) (void *),
 		  void *taskarg, ulapi_prio prio, ulapi_integer period_nsec)
 {
-  pthread_attr_t attr;
-  struct sched_param sched_param;
-
-  pthread_attr_init (&attr);
-  sched_param.sched_priority = prio;
-  pthread_attr_setschedparam (&attr, &sched_param);
-  pthread_create ((pthread_t *) task, &attr, (pthread_task_code) taskcode,
-		  taskarg);
-  pthread_setschedparam (*((pthread_t *) task), SCHED_OTHER, &sched_param);
-  /* ignore period_nsec, since we can't handle it in pthreads, so the
-     application must call ulapi_wait(period_nsec) */
+  unix_task_struct *ts = (unix_task_struct *) task;
+
+  if (NULL == ts || NULL == taskcode)
+    return ULAPI_BAD_ARGS;
+  ts->code = taskcode;
+  ts->arg = taskarg;
+  ts->prio = prio;
+  /* the task code still loops on ulapi_wait; this just sets the period
+     that ulapi_wait(0) uses */
+  if (period_nsec > 0)
+    ts->period_nsec = period_nsec;
+  ts->deadline_set = 0;
+  memset (&ts->stats, 0, sizeof (ts->stats));
+  if (0 != pthread_create (&ts->thread, NULL, unix_task_wrapper, task))
+    return ULAPI_ERROR;
 
   return ULAPI_OK;
 }
 
+ulapi_result
+ulapi_task_join (void *task)
+{
+  return (pthread_join (((unix_task_struct *) task)->thread, NULL) ==
+	  0 ? ULAPI_OK : ULAPI_ERROR);
+}
+
 ulapi_result
 ulapi_task_stop (void *task)
 {
-  return (pthread_cancel (*((pthread_t *) task)) ==
+  return (pthread_cancel (((unix_task_struct *) task)->thread) ==
 	  0 ? ULAPI_OK : ULAPI_ERROR);
 }
 
@@ -339,9 +647,145 @@ ulapi_task_resume (void *task)
   return ULAPI_OK;
 }
 
+/*
+  Takes effect at the task's next ulapi_wait(0).
+*/
 ulapi_result
 ulapi_task_set_period (void *task, ulapi_integer period_nsec)
 {
+  if (NULL == task || period_nsec < 0)
+    return ULAPI_BAD_ARGS;
+  __atomic_store_n (&((unix_task_struct *) task)->period_nsec, period_nsec,
+		    __ATOMIC_RELAXED);
+
+  return ULAPI_OK;
+}
+
+static unix_task_struct *
+unix_get_self_task (void)
+{
+  unix_task_struct *task;
+
+  if (NULL == unix_self_task)
+    {
+      /* main or another thread not started by ulapi; never freed */
+      task = (unix_task_struct *) malloc (sizeof (unix_task_struct));
+      if (NULL == task)
+	return NULL;
+      unix_task_init_struct (task);
+      task->thread = pthread_self ();
+      unix_self_task = task;
+    }
+
+  return unix_self_task;
+}
+
+ulapi_result
+ulapi_self_set_period (ulapi_integer period_nsec)
+{
+  unix_task_struct *task = unix_get_self_task ();
+
+  if (NULL == task)
+    return ULAPI_ERROR;
+  if (period_nsec < 0)
+    return ULAPI_BAD_ARGS;
+  __atomic_store_n (&task->period_nsec, period_nsec, __ATOMIC_RELAXED);
+  /* start the new period from the next wait */
+  task->deadline_set = 0;
+
+  return ULAPI_OK;
+}
+
+static void
+unix_timespec_add (struct timespec *ts, long long nsec)
+{
+  nsec += ts->tv_nsec;
+  ts->tv_sec += nsec / 1000000000LL;
+  ts->tv_nsec = nsec % 1000000000LL;
+}
+
+static long long
+unix_timespec_diff (const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+/*
+  Sleep until the calling task's next deadline. A positive period_nsec
+  becomes the task's period; 0 keeps the period set by
+  ulapi_task_start, ulapi_task_set_period or ulapi_self_set_period. The
+  first wait of a period only sets the deadline one period from now.
+*/
+ulapi_result
+ulapi_wait (ulapi_integer period_nsec)
+{
+  unix_task_struct *task = unix_get_self_task ();
+  struct timespec now;
+  long long period;
+  long long late;
+  int err;
+
+  if (NULL == task)
+    return ULAPI_ERROR;
+  if (period_nsec > 0)
+    __atomic_store_n (&task->period_nsec, period_nsec, __ATOMIC_RELAXED);
+  period = __atomic_load_n (&task->period_nsec, __ATOMIC_RELAXED);
+  if (period <= 0)
+    return ULAPI_BAD_ARGS;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  if (!task->deadline_set)
+    {
+      task->deadline = now;
+      task->deadline_set = 1;
+    }
+  unix_timespec_add (&task->deadline, period);
+  late = unix_timespec_diff (&now, &task->deadline);
+  if (late >= 0)
+    {
+      /* overran; skip the periods we missed rather than run them
+         back to back */
+      task->stats.misses++;
+      unix_timespec_add (&task->deadline, (late / period + 1) * period);
+    }
+
+  do
+    {
+      err = clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME,
+			     &task->deadline, NULL);
+    }
+  while (EINTR == err);
+  if (0 != err)
+    return ULAPI_ERROR;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  late = unix_timespec_diff (&now, &task->deadline);
+  if (late < 0)
+    late = 0;
+  task->stats.cycles++;
+  task->stats.jitter_sum += late * 1.0e-9;
+  if (late * 1.0e-9 > task->stats.jitter_max)
+    task->stats.jitter_max = late * 1.0e-9;
+
+  return ULAPI_OK;
+}
+
+/*
+  The owning thread updates the counters without a lock, so a copy taken
+  from another thread may mix two consecutive cycles.
+*/
+ulapi_result
+ulapi_task_get_stats (void *task, ulapi_task_stats * stats)
+{
+  unix_task_struct *ts;
+
+  if (NULL == stats)
+    return ULAPI_BAD_ARGS;
+  ts = (NULL == task) ? unix_get_self_task () : (unix_task_struct *) task;
+  if (NULL == ts)
+    return ULAPI_ERROR;
+  *stats = ts->stats;
+
   return ULAPI_OK;
 }
 
@@ -369,3 +813,70 @@ void ulapi_sleep(ulapi_real secs)
 
   (void) nanosleep(&ts, NULL);
 }
+
+ulapi_real
+ulapi_time (void)
+{
+  struct timeval tv;
+
+  (void) gettimeofday (&tv, NULL);
+  return ((ulapi_real) tv.tv_sec) + ((ulapi_real) tv.tv_usec) * 1.0e-6;
+}
+
+ulapi_real
+ulapi_monotime (void)
+{
+  return unix_monotonic ();
+}
+
+/*
+  Semaphores are only shared between the threads of this process, so the
+  key is ignored, as it is for mutexes.
+*/
+void *
+ulapi_sem_new (ulapi_id key)
+{
+  sem_t *sem;
+
+  sem = (sem_t *) malloc (sizeof (sem_t));
+  if (NULL == (void *) sem)
+    return NULL;
+
+  /* semaphores start out taken */
+  if (0 == sem_init (sem, 0, 0))
+    return (void *) sem;
+
+  free (sem);
+  return NULL;
+}
+
+ulapi_result
+ulapi_sem_delete (void *sem)
+{
+  if (NULL == sem)
+    return ULAPI_ERROR;
+
+  (void) sem_destroy ((sem_t *) sem);
+  free (sem);
+
+  return ULAPI_OK;
+}
+
+ulapi_result
+ulapi_sem_give (void *sem)
+{
+  return 0 == sem_post ((sem_t *) sem) ? ULAPI_OK : ULAPI_ERROR;
+}
+
+ulapi_result
+ulapi_sem_take (void *sem)
+{
+  int retval;
+
+  /* restart if a signal interrupts the wait */
+  do
+    retval = sem_wait ((sem_t *) sem);
+  while (retval != 0 && errno == EINTR);
+
+  return 0 == retval ? ULAPI_OK : ULAPI_ERROR;
+}
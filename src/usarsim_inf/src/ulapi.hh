@@ -76,6 +76,8 @@ enum
 };
 
 extern ulapi_real ulapi_time (void);
+/*! seconds on a clock that never steps, for measuring intervals */
+extern ulapi_real ulapi_monotime (void);
 
 extern void ulapi_sleep (ulapi_real secs);
 
@@ -163,6 +165,42 @@ extern ulapi_result ulapi_task_set_period (void *task,
 extern ulapi_result ulapi_task_init (void);
 extern ulapi_result ulapi_self_set_period (ulapi_integer period_nsec);
 extern ulapi_result ulapi_wait (ulapi_integer period_nsec);
+
+/*!
+  Pin a task to one CPU, or let it run anywhere with a \a cpu of -1.
+  Call before ulapi_task_start.
+*/
+extern ulapi_result ulapi_task_set_cpu (void *task, ulapi_integer cpu);
+
+/*!
+  Run a task under SCHED_FIFO, with its ulapi priority mapped onto the
+  FIFO range. Call before ulapi_task_start. If the process may not use
+  SCHED_FIFO the task runs under the default policy and a warning is
+  logged.
+*/
+extern ulapi_result ulapi_task_set_fifo (void *task, ulapi_flag fifo);
+
+/*!
+  Timing of a periodic task. Each ulapi_wait sleeps until an absolute
+  deadline one period after the previous one, so the period does not
+  drift with the time spent in the loop. A wait that is called after its
+  deadline has passed counts as a miss and is moved to the next period
+  boundary. Jitter is how late the task woke up after its deadline.
+*/
+typedef struct
+{
+  ulapi_integer cycles;		/*!< waits completed */
+  ulapi_integer misses;		/*!< deadlines already past when waited on */
+  ulapi_real jitter_max;	/*!< latest wakeup, in seconds */
+  ulapi_real jitter_sum;	/*!< sum of wakeup delays, in seconds */
+} ulapi_task_stats;
+
+/*!
+  Copy the timing of \a task, or of the calling thread if \a task is
+  NULL.
+*/
+extern ulapi_result ulapi_task_get_stats (void *task,
+					  ulapi_task_stats * stats);
 extern ulapi_result ulapi_task_exit (void);
 extern ulapi_result ulapi_task_join (void *task);
 extern ulapi_integer ulapi_task_id (void);
@@ -186,6 +224,31 @@ extern ulapi_result ulapi_mutex_give (void *mutex);
   blocks the caller until the mutex is given. */
 extern ulapi_result ulapi_mutex_take (void *mutex);
 
+/*! Names the mutex in ulapi_mutex_dump_stats. The name is copied. */
+extern ulapi_result ulapi_mutex_set_name (void *mutex, const char *name);
+
+/*!
+  Contention counters kept by every mutex. A take that finds the mutex
+  held spins briefly before it sleeps; either way it counts as
+  contended, and the time until it gets the mutex is its wait.
+*/
+typedef struct
+{
+  ulapi_integer acquisitions;	/*!< takes */
+  ulapi_integer contended;	/*!< takes that found the mutex held */
+  ulapi_real wait_total;	/*!< seconds spent in contended takes */
+  ulapi_real wait_max;		/*!< longest contended take, in seconds */
+} ulapi_mutex_stats;
+
+extern ulapi_result ulapi_mutex_get_stats (void *mutex,
+					   ulapi_mutex_stats * stats);
+
+/*!
+  Logs the counters of every named mutex, and the sum over the unnamed
+  ones.
+*/
+extern void ulapi_mutex_dump_stats (void);
+
 extern void *ulapi_sem_new (ulapi_id key);
 extern ulapi_result ulapi_sem_delete (void *sem);
 extern ulapi_result ulapi_sem_give (void *sem);
@@ -305,6 +368,12 @@ extern ulapi_integer ulapi_socket_broadcast (ulapi_integer id,
  */
 extern ulapi_result ulapi_socket_close (ulapi_integer id);
 
+/*!
+  Stops reading from the socket id. A read blocked on it, in any thread,
+  returns 0 as if the peer had closed; writes still go through.
+ */
+extern ulapi_result ulapi_socket_shutdown_read (ulapi_integer id);
+
 /*
   File descriptor (fd) API
 */
@@ -69,6 +69,14 @@ main (int argc, char **argv)
   // initialize the USARSim interface wrapper
   usarsim->init (servo);
 
+  // publish from a thread of its own, so that socket reads never wait on ROS
+  if (usarsim->startPipeline () != 1)
+    ROS_WARN ("unable to start the publish thread, publishing from the socket thread");
+  if (usarsim->startDrive () != 1)
+    ROS_WARN ("unable to start the drive task, sending cmd_vel as it arrives");
+  if (servo->startTrajectories () != 1)
+    ROS_WARN ("unable to start the trajectory task, arm goals will not be followed");
+
   rosTask = ulapi_task_new ();
 
   ulapi_task_start (rosTask, rosThread, (void *) servo, ulapi_prio_lowest (),
@@ -83,5 +91,11 @@ main (int argc, char **argv)
 	  break;
 	}
     }
+  servo->stopScans ();
+  servo->stopTrajectories ();
+  usarsim->stopDrive ();
+  usarsim->stopPipeline ();
+  servo->stopClouds ();
+  ulapi_mutex_dump_stats ();
   ulapi_exit ();
 }
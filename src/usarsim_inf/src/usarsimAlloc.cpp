@@ -0,0 +1,233 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimAlloc.cpp
+  \brief  Scratch arena and heap allocation accounting for the servo path.
+
+  Built with USARSIM_COUNT_ALLOCS, the global operator new/delete are
+  replaced by thin wrappers around malloc/free that bump a per-thread
+  counter. The replacement covers every allocation in the process,
+  roscpp and any other nodelet in the same manager included, so it is
+  only built in on request. Without it the counter stays at 0.
+*/
+#include <new>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include "usarsimAlloc.hh"
+
+// the exception specifications of the replaceable operators changed in C++11
+#if __cplusplus >= 201103L
+#define ALLOC_THROW
+#define ALLOC_NOTHROW noexcept
+#else
+#define ALLOC_THROW throw (std::bad_alloc)
+#define ALLOC_NOTHROW throw ()
+#endif
+
+static __thread unsigned long threadAllocs = 0;
+static __thread int threadPaused = 0;
+
+#ifdef USARSIM_COUNT_ALLOCS
+static inline void
+countAlloc (void)
+{
+  if (!threadPaused)
+    threadAllocs++;
+}
+
+static void *
+countedMalloc (size_t size)
+{
+  void *ptr;
+
+  countAlloc ();
+  ptr = malloc (size ? size : 1);
+  if (ptr == NULL)
+    throw std::bad_alloc ();
+  return ptr;
+}
+
+void *
+operator new (size_t size) ALLOC_THROW
+{
+  return countedMalloc (size);
+}
+
+void *
+operator new[] (size_t size) ALLOC_THROW
+{
+  return countedMalloc (size);
+}
+
+void *
+operator new (size_t size, const std::nothrow_t &) ALLOC_NOTHROW
+{
+  countAlloc ();
+  return malloc (size ? size : 1);
+}
+
+void *
+operator new[] (size_t size, const std::nothrow_t &) ALLOC_NOTHROW
+{
+  countAlloc ();
+  return malloc (size ? size : 1);
+}
+
+void
+operator delete (void *ptr) ALLOC_NOTHROW
+{
+  free (ptr);
+}
+
+void
+operator delete[] (void *ptr) ALLOC_NOTHROW
+{
+  free (ptr);
+}
+
+void
+operator delete (void *ptr, const std::nothrow_t &) ALLOC_NOTHROW
+{
+  free (ptr);
+}
+
+void
+operator delete[] (void *ptr, const std::nothrow_t &) ALLOC_NOTHROW
+{
+  free (ptr);
+}
+#endif
+
+unsigned long
+usarsim_alloc_thread_count (void)
+{
+  return threadAllocs;
+}
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimAllocPause
+////////////////////////////////////////////////////////////////////////
+UsarsimAllocPause::UsarsimAllocPause ()
+{
+  threadPaused++;
+}
+
+UsarsimAllocPause::~UsarsimAllocPause ()
+{
+  threadPaused--;
+}
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimAllocProbe
+////////////////////////////////////////////////////////////////////////
+UsarsimAllocProbe::UsarsimAllocProbe ()
+{
+  messages = 0;
+  dirtyMessages = 0;
+  allocations = 0;
+  lastAllocations = 0;
+  startCount = 0;
+}
+
+void
+UsarsimAllocProbe::start ()
+{
+  startCount = threadAllocs;
+}
+
+void
+UsarsimAllocProbe::stop ()
+{
+  lastAllocations = threadAllocs - startCount;
+  messages++;
+  allocations += lastAllocations;
+  if (lastAllocations)
+    dirtyMessages++;
+}
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimArena
+////////////////////////////////////////////////////////////////////////
+UsarsimArena::UsarsimArena (size_t blockSizeIn)
+{
+  blockSize = blockSizeIn;
+  blocks.reserve (8);
+  blocks.push_back (std::make_pair ((char *) malloc (blockSize), blockSize));
+  current = 0;
+  used = 0;
+  growths = 0;
+}
+
+UsarsimArena::~UsarsimArena ()
+{
+  for (unsigned int i = 0; i < blocks.size (); i++)
+    free (blocks[i].first);
+}
+
+void
+UsarsimArena::reset ()
+{
+  current = 0;
+  used = 0;
+}
+
+void *
+UsarsimArena::alloc (size_t size)
+{
+  void *ptr;
+
+  // keep everything aligned for doubles
+  size = (size + 7) & ~(size_t) 7;
+  while (used + size > blocks[current].second)
+    {
+      current++;
+      used = 0;
+      if (current == blocks.size ())
+	{
+	  size_t newSize = size > blockSize ? size : blockSize;
+	  blocks.push_back (std::make_pair ((char *) malloc (newSize),
+					    newSize));
+	  growths++;
+	}
+    }
+  ptr = blocks[current].first + used;
+  used += size;
+  return ptr;
+}
+
+const char *
+UsarsimArena::printf (const char *fmt, ...)
+{
+  va_list ap;
+  char *str;
+  size_t room;
+  int len;
+
+  // try to format into what is left of the current block first
+  room = blocks[current].second - used;
+  str = blocks[current].first + used;
+  va_start (ap, fmt);
+  len = vsnprintf (str, room, fmt, ap);
+  va_end (ap);
+  if (len < 0)
+    return "";
+  if ((size_t) len < room)
+    {
+      alloc (len + 1);
+      return str;
+    }
+  str = (char *) alloc (len + 1);
+  va_start (ap, fmt);
+  vsnprintf (str, len + 1, fmt, ap);
+  va_end (ap);
+  return str;
+}
@@ -0,0 +1,94 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimAlloc.hh
+  \brief  Scratch arena and heap allocation accounting for the servo path.
+
+  UsarsimArena is a bump allocator that is reset once per message so that
+  temporaries (formatted frame names and the like) never touch the heap
+  after warm-up. The allocation counter hooks the global operator new so
+  that ServoInf can prove its steady state is allocation free; it is only
+  built in with USARSIM_COUNT_ALLOCS.
+*/
+#ifndef __usarsimAlloc__
+#define __usarsimAlloc__
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////
+// Allocation counter
+////////////////////////////////////////////////////////////////////////
+//! number of heap allocations made by the calling thread; always 0
+//! unless built with USARSIM_COUNT_ALLOCS
+extern unsigned long usarsim_alloc_thread_count (void);
+
+/*!
+  While a UsarsimAllocPause is in scope, allocations made by the calling
+  thread are not charged to usarsim_alloc_thread_count(). Used around
+  roscpp publish calls, whose serialization buffers are outside of our
+  control.
+*/
+class UsarsimAllocPause
+{
+public:
+  UsarsimAllocPause ();
+  ~UsarsimAllocPause ();
+};
+
+/*!
+  Accumulates the number of allocations charged to a message handler.
+  start() and stop() bracket one message.
+*/
+class UsarsimAllocProbe
+{
+public:
+  UsarsimAllocProbe ();
+  void start ();
+  void stop ();
+  unsigned long messages;	//!< messages measured
+  unsigned long dirtyMessages;	//!< messages that allocated at least once
+  unsigned long allocations;	//!< total allocations charged
+  unsigned long lastAllocations;	//!< allocations of the last message
+private:
+  unsigned long startCount;
+};
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimArena
+////////////////////////////////////////////////////////////////////////
+class UsarsimArena
+{
+public:
+  UsarsimArena (size_t blockSize = 4096);
+  ~UsarsimArena ();
+  //! release everything handed out since the last reset, keeping the blocks
+  void reset ();
+  void *alloc (size_t size);
+  //! printf into arena memory; the result is valid until the next reset
+  const char *printf (const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+  //! number of blocks that had to be added after construction
+  unsigned int getGrowths ()
+  {
+    return growths;
+  }
+private:
+  UsarsimArena (const UsarsimArena &);
+  UsarsimArena & operator= (const UsarsimArena &);
+  size_t blockSize;
+  std::vector < std::pair < char *, size_t > >blocks;
+  unsigned int current;		// block being carved
+  size_t used;			// bytes used in the current block
+  unsigned int growths;
+};
+
+#endif
@@ -0,0 +1,319 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimCloud.cpp
+  \brief  Turns range imager scans into point clouds on a thread of its own.
+*/
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include "ulapi.hh"
+#include "usarsimCloud.hh"
+
+#define POINT_STEP sizeof (UsarsimFloat4)	// x, y, z and padding
+#define VOXEL_BITS 21			// per axis in a voxel key
+#define VOXEL_BIAS (1 << (VOXEL_BITS - 1))	// keeps voxel indices positive
+
+static void
+cloudTask (void *arg)
+{
+  reinterpret_cast < UsarsimCloud * >(arg)->run ();
+}
+
+UsarsimCloud::UsarsimCloud ()
+{
+  projected = 0;
+  dropped = 0;
+  voxel = 0;
+  depth = false;
+  memset (pendingK, 0, sizeof (pendingK));
+  memset (pendingRange, 0, sizeof (pendingRange));
+  mutex = ulapi_mutex_new (0);
+  ulapi_mutex_set_name (mutex, "cloud");
+  sem = ulapi_sem_new (0);
+  task = NULL;
+  running = 0;
+  rayWidth = 0;
+  rayHeight = 0;
+  memset (rayK, 0, sizeof (rayK));
+}
+
+UsarsimCloud::~UsarsimCloud ()
+{
+  stop ();
+  ulapi_sem_delete (sem);
+  ulapi_mutex_delete (mutex);
+}
+
+void
+UsarsimCloud::configure (double voxelIn, bool depthIn)
+{
+  voxel = voxelIn > 0 ? voxelIn : 0;
+  depth = depthIn;
+  rayWidth = 0;			// the rays depend on depth
+}
+
+int
+UsarsimCloud::start (const std::string & nameIn)
+{
+  if (task != NULL)
+    return 1;
+  name = nameIn;
+  if (sem == NULL)
+    {
+      ROS_ERROR ("usarsimCloud: unable to create a semaphore for %s",
+		 name.c_str ());
+      return -1;
+    }
+  __atomic_store_n (&running, 1, __ATOMIC_SEQ_CST);
+  task = ulapi_task_new ();
+  if (ULAPI_OK != ulapi_task_start (task, cloudTask, (void *) this,
+				    ulapi_prio_lowest (), 0))
+    {
+      ROS_ERROR ("usarsimCloud: unable to start the point cloud thread for %s",
+		 name.c_str ());
+      ulapi_task_delete (task);
+      task = NULL;
+      return -1;
+    }
+  return 1;
+}
+
+void
+UsarsimCloud::stop ()
+{
+  if (task == NULL)
+    return;
+  __atomic_store_n (&running, 0, __ATOMIC_SEQ_CST);
+  ulapi_sem_give (sem);
+  ulapi_task_join (task);
+  ulapi_task_delete (task);
+  task = NULL;
+  ROS_INFO ("%s: %lu point clouds, %lu scans dropped", name.c_str (),
+	    projected, dropped);
+}
+
+void
+UsarsimCloud::put (const boost::shared_ptr < const sensor_msgs::Image > &image,
+		   const sensor_msgs::CameraInfo & info, double minRange,
+		   double maxRange)
+{
+  ulapi_mutex_take (mutex);
+  if (pending)
+    dropped++;
+  pending = image;
+  pendingK[0] = info.K[0];
+  pendingK[1] = info.K[4];
+  pendingK[2] = info.K[2];
+  pendingK[3] = info.K[5];
+  pendingRange[0] = minRange;
+  pendingRange[1] = maxRange > minRange ? maxRange
+    : std::numeric_limits < float >::max ();
+  ulapi_mutex_give (mutex);
+  ulapi_sem_give (sem);
+}
+
+/*
+  Ray through the middle of each pixel in the optical frame (x right, y
+  down, z forward). A range along the ray needs the ray of unit length; a
+  depth along z needs z = 1.
+*/
+void
+UsarsimCloud::buildRays (unsigned int width, unsigned int height,
+			 const double *k)
+{
+  double fx = k[0], fy = k[1], cx = k[2], cy = k[3];
+
+  rays.resize (width * height);
+  for (unsigned int v = 0; v < height; v++)
+    for (unsigned int u = 0; u < width; u++)
+      {
+	double x = (u - cx) / fx;
+	double y = (v - cy) / fy;
+	double z = 1;
+	UsarsimFloat4 & ray = rays[v * width + u];
+
+	if (!depth)
+	  {
+	    double n = sqrt (x * x + y * y + z * z);
+	    x /= n;
+	    y /= n;
+	    z /= n;
+	  }
+	ray[0] = x;
+	ray[1] = y;
+	ray[2] = z;
+	ray[3] = 0;
+      }
+  rayWidth = width;
+  rayHeight = height;
+  memcpy (rayK, k, sizeof (rayK));
+}
+
+/*
+  Scale each pixel's ray by its range, four floats at a time. Points are
+  written to out one after the other; pixels without a return, outside
+  range[0] to range[1], are NaN if keepInvalid is set and skipped
+  otherwise. Returns the points written.
+*/
+unsigned int
+UsarsimCloud::project (const sensor_msgs::Image & image, const float *limits,
+		       uint8_t * out, bool keepInvalid)
+{
+  const float minRange = limits[0];
+  const float maxRange = limits[1];
+  const float nan = std::numeric_limits < float >::quiet_NaN ();
+  const UsarsimFloat4 none = { nan, nan, nan, 0 };
+  const UsarsimFloat4 *ray = &rays[0];
+  unsigned int count = 0;
+
+  for (unsigned int v = 0; v < image.height; v++)
+    {
+      const float *range =
+	reinterpret_cast < const float *>(&image.data[v * image.step]);
+
+      for (unsigned int u = 0; u < image.width; u++, ray++)
+	{
+	  float r = range[u];
+
+	  if (r > minRange && r < maxRange)
+	    {
+	      UsarsimFloat4 scale = { r, r, r, r };
+	      UsarsimFloat4 point = *ray * scale;
+	      // out is only as aligned as the message's byte buffer
+	      memcpy (out + count++ * POINT_STEP, &point, POINT_STEP);
+	    }
+	  else if (keepInvalid)
+	    memcpy (out + count++ * POINT_STEP, &none, POINT_STEP);
+	}
+    }
+  return count;
+}
+
+/*
+  One point per occupied voxel, at the centroid of the points in it.
+  Sorting by voxel key puts each voxel's points next to each other.
+*/
+void
+UsarsimCloud::thin (unsigned int count, sensor_msgs::PointCloud2 & cloud)
+{
+  const uint64_t mask = (1 << VOXEL_BITS) - 1;
+  unsigned int kept = 0;
+
+  keys.resize (count);
+  for (unsigned int i = 0; i < count; i++)
+    {
+      const UsarsimFloat4 & p = points[i];
+      uint64_t ix = ((int64_t) floor (p[0] / voxel) + VOXEL_BIAS) & mask;
+      uint64_t iy = ((int64_t) floor (p[1] / voxel) + VOXEL_BIAS) & mask;
+      uint64_t iz = ((int64_t) floor (p[2] / voxel) + VOXEL_BIAS) & mask;
+
+      keys[i].first = ix << (2 * VOXEL_BITS) | iy << VOXEL_BITS | iz;
+      keys[i].second = i;
+    }
+  std::sort (keys.begin (), keys.end ());
+
+  cloud.data.resize (count * POINT_STEP);
+  for (unsigned int i = 0; i < count;)
+    {
+      UsarsimFloat4 sum = points[keys[i].second];
+      unsigned int j = i + 1;
+
+      for (; j < count && keys[j].first == keys[i].first; j++)
+	sum += points[keys[j].second];
+      float n = j - i;
+      UsarsimFloat4 scale = { 1 / n, 1 / n, 1 / n, 0 };
+      sum *= scale;
+      memcpy (&cloud.data[kept++ * POINT_STEP], &sum, POINT_STEP);
+      i = j;
+    }
+  cloud.data.resize (kept * POINT_STEP);
+  setFields (cloud, kept, 1);
+}
+
+void
+UsarsimCloud::setFields (sensor_msgs::PointCloud2 & cloud, unsigned int width,
+			 unsigned int height)
+{
+  static const char *names[] = { "x", "y", "z" };
+
+  // pooled clouds keep their fields
+  if (cloud.fields.size () != 3)
+    {
+      cloud.fields.resize (3);
+      for (unsigned int i = 0; i < 3; i++)
+	{
+	  cloud.fields[i].name = names[i];
+	  cloud.fields[i].offset = i * sizeof (float);
+	  cloud.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+	  cloud.fields[i].count = 1;
+	}
+    }
+  cloud.width = width;
+  cloud.height = height;
+  cloud.is_bigendian = false;
+  cloud.point_step = POINT_STEP;
+  cloud.row_step = POINT_STEP * width;
+  cloud.is_dense = voxel > 0;	// thinned clouds have no NaN
+}
+
+void
+UsarsimCloud::run ()
+{
+  boost::shared_ptr < const sensor_msgs::Image > image;
+  boost::shared_ptr < sensor_msgs::PointCloud2 > cloud;
+  double k[4];
+  float limits[2];
+
+  for (;;)
+    {
+      ulapi_sem_take (sem);
+      ulapi_mutex_take (mutex);
+      if (!__atomic_load_n (&running, __ATOMIC_SEQ_CST))
+	{
+	  ulapi_mutex_give (mutex);
+	  break;
+	}
+      image.swap (pending);
+      memcpy (k, pendingK, sizeof (k));
+      memcpy (limits, pendingRange, sizeof (limits));
+      ulapi_mutex_give (mutex);
+      if (!image || image->width == 0 || image->height == 0 || k[0] <= 0
+	  || k[1] <= 0)
+	continue;
+
+      if (image->width != rayWidth || image->height != rayHeight
+	  || memcmp (k, rayK, sizeof (k)))
+	buildRays (image->width, image->height, k);
+
+      cloud = cloudPool.take ();
+      cloud->header = image->header;
+      if (voxel > 0)
+	{
+	  points.resize (image->width * image->height);
+	  thin (project (*image, limits,
+			 reinterpret_cast < uint8_t * >(&points[0]), false),
+		*cloud);
+	}
+      else
+	{
+	  setFields (*cloud, image->width, image->height);
+	  cloud->data.resize (image->width * image->height * POINT_STEP);
+	  project (*image, limits, &cloud->data[0], true);
+	}
+      pub.publish (boost::shared_ptr < const sensor_msgs::PointCloud2 > (cloud));
+      projected++;
+      // let go of both, so their pools can hand them out again
+      cloud.reset ();
+      image.reset ();
+    }
+}
@@ -0,0 +1,93 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimCloud.hh
+  \brief  Turns range imager scans into point clouds on a thread of its own.
+
+  Every pixel of a scan is a range along that pixel's ray, so the cloud
+  is the ray table scaled by the image. The table is worked out from the
+  camera info once per imager configuration and holds one four float
+  vector per pixel, which makes each point a single vector multiply.
+  Clouds are either organized, one point per pixel with NaN for no
+  return, or thinned to one point per voxel.
+*/
+#ifndef __usarsimCloud__
+#define __usarsimCloud__
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <ros/ros.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/PointCloud2.h>
+#include "usarsimPool.hh"
+
+typedef float UsarsimFloat4 __attribute__ ((vector_size (16)));
+
+class UsarsimCloud
+{
+public:
+  UsarsimCloud ();
+  ~UsarsimCloud ();
+  /*!
+    voxel is the leaf size in meters, 0 for an organized cloud. With
+    depth set the image holds distance along the optical axis, as a
+    Kinect's does, rather than along each ray. Call before start.
+  */
+  void configure (double voxelIn, bool depthIn);
+  //! start the projection thread; name is only for the log
+  int start (const std::string & nameIn);
+  void stop ();
+  /*!
+    Any thread. Queue a finished scan, which must not change any more;
+    a scan still waiting when the next arrives is dropped for it. Ranges
+    outside (minRange, maxRange) are no return.
+  */
+  void put (const boost::shared_ptr < const sensor_msgs::Image > &image,
+	    const sensor_msgs::CameraInfo & info, double minRange,
+	    double maxRange);
+  //! body of the projection thread
+  void run ();
+  ros::Publisher pub;
+  unsigned long projected;	//!< clouds published
+  unsigned long dropped;	//!< scans replaced before they were projected
+private:
+  UsarsimCloud (const UsarsimCloud &);
+  UsarsimCloud & operator= (const UsarsimCloud &);
+  void buildRays (unsigned int width, unsigned int height, const double *k);
+  unsigned int project (const sensor_msgs::Image & image, const float *limits,
+			uint8_t * out, bool keepInvalid);
+  void thin (unsigned int count, sensor_msgs::PointCloud2 & cloud);
+  void setFields (sensor_msgs::PointCloud2 & cloud, unsigned int width,
+		  unsigned int height);
+  std::string name;
+  double voxel;
+  bool depth;
+  // newest scan waiting for the thread, guarded by mutex
+  boost::shared_ptr < const sensor_msgs::Image > pending;
+  double pendingK[4];		// fx, fy, cx, cy of pending
+  float pendingRange[2];	// min and max range of pending
+  void *mutex;
+  void *sem;
+  void *task;
+  int running;
+  // projection thread only
+  std::vector < UsarsimFloat4 > rays;	// one per pixel, w unused
+  unsigned int rayWidth;
+  unsigned int rayHeight;
+  double rayK[4];
+  std::vector < UsarsimFloat4 > points;	// valid points, for thinning
+  std::vector < std::pair < uint64_t, uint32_t > > keys;	// voxel of each point
+  UsarsimPool < sensor_msgs::PointCloud2 > cloudPool;
+};
+
+#endif
@@ -0,0 +1,263 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimDrive.cpp
+  \brief  Turns cmd_vel into Drive commands for a ground vehicle.
+*/
+#include <math.h>
+#include <string.h>
+#include <ros/ros.h>
+#include "ulapi.hh"
+#include "usarsimInf.hh"
+#include "usarsimDrive.hh"
+
+static void
+driveTask (void *arg)
+{
+  reinterpret_cast < UsarsimDrive * >(arg)->run ();
+}
+
+UsarsimDrive::UsarsimDrive (UsarsimInf * infIn)
+{
+  inf = infIn;
+  mutex = ulapi_mutex_new (0);
+  ulapi_mutex_set_name (mutex, "drive");
+  task = NULL;
+  running = 0;
+  timeout = 0;
+  configured = false;
+  steerType = SW_STEER_UNKNOWN;
+  halfSeparation = 0;
+  invRadius = 0;
+  maxSpeed = 0;
+  wheelBase = 0;
+  memset (&pending, 0, sizeof (pending));
+  fresh = false;
+  lastCommand = 0;
+  moving = false;
+  received = 0;
+  superseded = 0;
+  sent = 0;
+  stops = 0;
+}
+
+UsarsimDrive::~UsarsimDrive ()
+{
+  stop ();
+  ulapi_mutex_delete (mutex);
+}
+
+int
+UsarsimDrive::start (double rate, double timeoutIn, int cpu, bool fifo)
+{
+  if (task != NULL || rate <= 0)
+    return 1;
+  timeout = timeoutIn;
+  __atomic_store_n (&running, 1, __ATOMIC_SEQ_CST);
+  task = ulapi_task_new ();
+  if (cpu >= 0)
+    ulapi_task_set_cpu (task, cpu);
+  ulapi_task_set_fifo (task, fifo);
+  if (ULAPI_OK != ulapi_task_start (task, driveTask, (void *) this,
+				    ulapi_prio_highest (),
+				    (ulapi_integer) (1.0e9 / rate)))
+    {
+      ROS_ERROR ("usarsimDrive: unable to start the drive task");
+      ulapi_task_delete (task);
+      task = NULL;
+      return -1;
+    }
+  ROS_INFO ("usarsimDrive: sending Drive at %.1f Hz, stopping after %.2f s without cmd_vel",
+	    rate, timeout);
+  return 1;
+}
+
+void
+UsarsimDrive::stop ()
+{
+  ulapi_task_stats stats;
+
+  if (task == NULL)
+    return;
+  __atomic_store_n (&running, 0, __ATOMIC_SEQ_CST);
+  ulapi_task_join (task);
+  ulapi_task_get_stats (task, &stats);
+  ulapi_task_delete (task);
+  task = NULL;
+  ROS_INFO ("usarsimDrive: %lu cmd_vel, %lu superseded, %lu Drive sent, "
+	    "%lu watchdog stops; %ld ticks, %ld missed, jitter %.6f s mean %.6f s max",
+	    received, superseded, sent, stops, (long) stats.cycles,
+	    (long) stats.misses,
+	    stats.cycles ? (double) stats.jitter_sum / stats.cycles : 0.,
+	    (double) stats.jitter_max);
+}
+
+/*
+  Everything the Twist mapping needs is fixed once the vehicle is
+  configured, so work it out here rather than on every command.
+*/
+void
+UsarsimDrive::configure (const sw_robot_groundvehicle_struct & vehicle)
+{
+  UsarsimMutexLock lock (mutex);
+
+  configured = true;
+  steerType = vehicle.steertype;
+  halfSeparation = vehicle.wheel_separation / 2.;
+  invRadius = vehicle.wheel_radius > 0 ? 1. / vehicle.wheel_radius : 0.;
+  maxSpeed = vehicle.max_speed;
+  wheelBase = vehicle.wheel_base;
+}
+
+void
+UsarsimDrive::command (const sw_ros_cmd_vel_struct & vel)
+{
+  char str[MAX_MSG_LEN];
+  UsarsimMutexLock lock (mutex);
+
+  received++;
+  lastCommand = ulapi_time ();
+  if (task == NULL)
+    {
+      // no drive task, so send it now
+      if (format (vel, str, sizeof (str)))
+	{
+	  inf->writeCommand (str);
+	  sent++;
+	}
+      return;
+    }
+  if (fresh)
+    superseded++;
+  pending = vel;
+  fresh = true;
+}
+
+void
+UsarsimDrive::run ()
+{
+  char str[MAX_MSG_LEN];
+  bool haveCommand;
+
+  while (__atomic_load_n (&running, __ATOMIC_SEQ_CST))
+    {
+      ulapi_wait (0);
+      haveCommand = false;
+      ulapi_mutex_take (mutex);
+      if (fresh)
+	{
+	  fresh = false;
+	  haveCommand = format (pending, str, sizeof (str));
+	}
+      else if (moving && timeout > 0 && ulapi_time () - lastCommand > timeout)
+	{
+	  sw_ros_cmd_vel_struct halt;
+
+	  memset (&halt, 0, sizeof (halt));
+	  haveCommand = format (halt, str, sizeof (str));
+	  if (haveCommand)
+	    {
+	      stops++;
+	      ROS_WARN ("usarsimDrive: no cmd_vel for %.2f s, stopping",
+			ulapi_time () - lastCommand);
+	    }
+	}
+      if (haveCommand)
+	sent++;
+      ulapi_mutex_give (mutex);
+      if (haveCommand)
+	inf->writeCommand (str);
+    }
+}
+
+/*
+  Drive command for a Twist, from the equations of motion
+     SL = rTh
+     SR = (r + b)Th
+     SM = (r +b/2)Th
+  for skid steering. Returns 0 if this vehicle can't be driven by Twist.
+  Called with the mutex held.
+*/
+int
+UsarsimDrive::format (const sw_ros_cmd_vel_struct & vel, char *str,
+		      size_t len)
+{
+  double leftVel, rightVel;
+  double steerAngle, vehVel;
+  double scale;
+
+  if (!configured)
+    {
+      ROS_ERROR ("Currently only support ground robot");
+      return 0;
+    }
+  if (steerType == SW_STEER_SKID)
+    {
+      if (vel.lineary != 0 || vel.linearz != 0)
+	{
+	  ROS_WARN ("Invalid skid steering message <%f %f %f>",
+		    vel.linearx, vel.lineary, vel.linearz);
+	}
+      leftVel = (vel.linearx - vel.angularz * halfSeparation) * invRadius;
+      rightVel = (vel.linearx + vel.angularz * halfSeparation) * invRadius;
+      if (leftVel > maxSpeed)
+	{
+	  scale = maxSpeed / leftVel;
+	  ROS_WARN ("Left wheel spin speed too high! Scaling by %f%%",	// note that %% prints %
+		    100 * scale);
+	  leftVel = maxSpeed;
+	  rightVel *= scale;
+	}
+      if (rightVel > maxSpeed)
+	{
+	  scale = maxSpeed / rightVel;
+	  ROS_WARN ("Right wheel spin speed too high! Scaling by %f%%",
+		    100. * scale);
+	  rightVel = maxSpeed;
+	  leftVel *= scale;
+	}
+      ulapi_snprintf (str, len, "Drive {Left %f} {Right %f}\r\n", leftVel,
+		      rightVel);
+      moving = leftVel != 0 || rightVel != 0;
+    }
+  else if (steerType == SW_STEER_ACKERMAN)
+    {
+      if (vel.lineary != 0 || vel.linearz != 0
+	  || vel.angularx != 0 || vel.angulary != 0)
+	{
+	  ROS_WARN ("Invalid skid steering message <%f %f %f> <%f %f %f>",
+		    vel.linearx, vel.lineary, vel.linearz,
+		    vel.angularx, vel.angulary, vel.angularz);
+	}
+      if (vel.linearx == 0)
+	{
+	  steerAngle = vel.angularz;
+	  vehVel = 0.;
+	}
+      else
+	{
+	  steerAngle = atan2 (vel.angularz * wheelBase, vel.linearx);
+	  vehVel = vel.linearx / cos (steerAngle);
+	}
+      // fixeme! How do I know if it is front or rear steer?
+      ulapi_snprintf (str, len,
+		      "Drive {Speed %f} {FrontSteer %f} {RearSteer %f}\r\n",
+		      vehVel, steerAngle, steerAngle);
+      moving = vehVel != 0;
+    }
+  else
+    {
+      ROS_ERROR ("Currently only support skid steered and Ackerman steeredrobots");
+      return 0;
+    }
+  str[len - 1] = 0;
+  return 1;
+}
@@ -0,0 +1,69 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimDrive.hh
+  \brief  Turns cmd_vel into Drive commands for a ground vehicle.
+
+  cmd_vel callbacks only leave their Twist here. A periodic task sends
+  the newest one to the simulator once per tick, so the command rate is
+  set by /usarsim/driveRate and not by whoever publishes cmd_vel. If no
+  Twist arrives for /usarsim/driveTimeout seconds while the vehicle is
+  moving, the task stops it.
+*/
+#ifndef __usarsimDrive__
+#define __usarsimDrive__
+#include <stddef.h>
+#include "simware.hh"
+
+class UsarsimInf;
+
+class UsarsimDrive
+{
+public:
+  UsarsimDrive (UsarsimInf * infIn);
+  ~UsarsimDrive ();
+  //! start the drive task; a rate of 0 sends every Twist as it arrives
+  int start (double rate, double timeoutIn, int cpu, bool fifo);
+  void stop ();
+  //! socket thread: vehicle settings from CONF and GEO
+  void configure (const sw_robot_groundvehicle_struct & vehicle);
+  //! cmd_vel callbacks: replaces any Twist not yet sent
+  void command (const sw_ros_cmd_vel_struct & vel);
+  //! body of the drive task
+  void run ();
+private:
+  UsarsimDrive (const UsarsimDrive &);
+  UsarsimDrive & operator= (const UsarsimDrive &);
+  int format (const sw_ros_cmd_vel_struct & vel, char *str, size_t len);
+  UsarsimInf *inf;
+  void *mutex;
+  void *task;
+  int running;
+  double timeout;
+
+  // guarded by mutex
+  bool configured;
+  sw_steer_type steerType;
+  double halfSeparation;	// half the wheel separation
+  double invRadius;		// 1 / wheel radius
+  double maxSpeed;		// wheel spin limit
+  double wheelBase;
+  sw_ros_cmd_vel_struct pending;
+  bool fresh;			// pending has not been sent yet
+  double lastCommand;		// ulapi_time of the newest Twist
+  bool moving;			// last Drive sent was not a stop
+  unsigned long received;	// Twists handed in
+  unsigned long superseded;	// Twists replaced before they were sent
+  unsigned long sent;		// Drive commands written
+  unsigned long stops;		// stops sent by the watchdog
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimFrames.cpp
+  \brief  The robot's own frames, for placing components on each other.
+*/
+#include <string.h>
+#include "ulapi.hh"
+#include "usarsimFrames.hh"
+
+// tf ignores a leading slash on frame names
+static const char *
+frameName (const char *name)
+{
+  return name[0] == '/' ? name + 1 : name;
+}
+
+UsarsimFrameGraph::UsarsimFrameGraph ()
+{
+  mutex = ulapi_mutex_new (0);
+  ulapi_mutex_set_name (mutex, "servoFrames");
+}
+
+UsarsimFrameGraph::~UsarsimFrameGraph ()
+{
+  ulapi_mutex_delete (mutex);
+}
+
+// called with the mutex held
+int
+UsarsimFrameGraph::find (const char *name)
+{
+  name = frameName (name);
+  for (unsigned int i = 0; i < frames.size (); i++)
+    if (!strcmp (frames[i].name.c_str (), name))
+      return i;
+  return -1;
+}
+
+/*
+  Frames are only added, never removed, so parent indices stay valid.
+  A frame whose parent hasn't been seen yet is linked up when it is.
+*/
+void
+UsarsimFrameGraph::set (const geometry_msgs::TransformStamped & tf)
+{
+  ulapi_mutex_take (mutex);
+  int child = find (tf.child_frame_id.c_str ());
+  const char *parentName = frameName (tf.header.frame_id.c_str ());
+
+  if (child < 0)
+    {
+      Frame frame;
+
+      frame.name = frameName (tf.child_frame_id.c_str ());
+      frame.parent = -1;
+      frames.push_back (frame);
+      child = frames.size () - 1;
+      // frames that were waiting for this one
+      for (unsigned int i = 0; i < frames.size (); i++)
+	if (frames[i].parent < 0 && frames[i].parentName == frames[child].name)
+	  frames[i].parent = child;
+    }
+  Frame & frame = frames[child];
+  if (strcmp (frame.parentName.c_str (), parentName))
+    {
+      frame.parentName = parentName;
+      frame.parent = find (parentName);
+    }
+  tf::transformMsgToTF (tf.transform, frame.transform);
+  ulapi_mutex_give (mutex);
+}
+
+bool
+UsarsimFrameGraph::lookup (const std::string & target,
+			   const std::string & source, tf::Transform & out)
+{
+  ulapi_mutex_take (mutex);
+  const char *targetName = frameName (target.c_str ());
+  int f = find (source.c_str ());
+  unsigned int steps = 0;
+
+  out.setIdentity ();
+  if (!strcmp (frameName (source.c_str ()), targetName))
+    {
+      ulapi_mutex_give (mutex);
+      return true;
+    }
+  // walk up from source, the steps bound guarding against loops
+  while (f >= 0 && steps++ <= frames.size ())
+    {
+      out = frames[f].transform * out;
+      if (!strcmp (frames[f].parentName.c_str (), targetName))
+	{
+	  ulapi_mutex_give (mutex);
+	  return true;
+	}
+      f = frames[f].parent;
+    }
+  ulapi_mutex_give (mutex);
+  return false;
+}
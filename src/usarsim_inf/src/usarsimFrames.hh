@@ -0,0 +1,57 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimFrames.hh
+  \brief  The robot's own frames, for placing components on each other.
+
+  Every transform the servo interface works out (mounts from GEO, link
+  poses from actuator status) is also recorded here, so a component
+  mounted on another component's frame can be placed without listening
+  to /tf.
+*/
+#ifndef __usarsimFrames__
+#define __usarsimFrames__
+#include <string>
+#include <vector>
+#include <tf/transform_datatypes.h>
+#include <geometry_msgs/TransformStamped.h>
+
+class UsarsimFrameGraph
+{
+public:
+  UsarsimFrameGraph ();
+  ~UsarsimFrameGraph ();
+  //! record where tf's child frame sits in its parent frame
+  void set (const geometry_msgs::TransformStamped & tf);
+  /*!
+    Transform from frame source to frame target, as
+    tf::TransformListener::lookupTransform (target, source, ...) would
+    give it. Returns false if source is not connected to target through
+    its parents.
+  */
+  bool lookup (const std::string & target, const std::string & source,
+	       tf::Transform & out);
+private:
+  UsarsimFrameGraph (const UsarsimFrameGraph &);
+  UsarsimFrameGraph & operator= (const UsarsimFrameGraph &);
+  typedef struct
+  {
+    std::string name;
+    std::string parentName;
+    int parent;			// index of parentName, -1 until it is known
+    tf::Transform transform;	// this frame in its parent
+  } Frame;
+  int find (const char *name);
+  std::vector < Frame > frames;
+  void *mutex;
+};
+
+#endif
@@ -28,16 +28,45 @@
   \date   October 19, 2011
 */
 #include "usarsimInf.hh"
+#include <ros/names.h>
 #include <XmlRpcValue.h>
 
 UsarsimInf::UsarsimInf ():GenericInf ()
 {
   socket_fd = -1;
   socket_mutex = NULL;
+  stopped = false;
   buildlen = BUFFERLEN;
   build = NULL;
   waitingForConf = 0;
   waitingForGeo = 0;
+  pipeline = NULL;
+  drive = new UsarsimDrive (this);
+  memset (&stateWork, 0, sizeof (stateWork));
+  stateDirty = false;
+  tracing = false;
+  traceReport = 0;
+  lastTraceReport = 0;
+  lineReceived = 0;
+  lineFramed = 0;
+  traceMutex = ulapi_mutex_new (0);
+  ulapi_mutex_set_name (traceMutex, "trace");
+}
+
+/*
+  The socket thread must have stopped; the parsed component lists are
+  left alone, as nothing but it walks them.
+*/
+UsarsimInf::~UsarsimInf ()
+{
+  stopPipeline ();
+  delete drive;
+  if (socket_fd >= 0)
+    ulapi_socket_close (socket_fd);
+  if (socket_mutex != NULL)
+    ulapi_mutex_delete (socket_mutex);
+  ulapi_mutex_delete (traceMutex);
+  free (build);
 }
 
 int
@@ -77,6 +106,20 @@ UsarsimInf::init (GenericInf * siblingIn)
 
   nh->param < int >("/usarsim/port", port, 3000);
   ROS_DEBUG ("parameter /usarsim/port: %d", port);
+  // the platform pose in the robot state comes from the odometry sensor
+  nh->param < std::string > ("/usarsim/odomSensor", stateOdomName, "");
+  nh->param < bool > ("/usarsim/trace", tracing, false);
+  nh->param < double >("/usarsim/traceReport", traceReport, 10.);
+  ROS_DEBUG ("parameter /usarsim/trace: %d", (int) tracing);
+  if (tracing)
+    {
+      dumpLatencyService = nh->advertiseService ("dump_latency",
+						 &UsarsimInf::dumpLatencyCallback,
+						 this);
+      clearLatencyService = nh->advertiseService ("clear_latency",
+						  &UsarsimInf::clearLatencyCallback,
+						  this);
+    }
 
   socket_fd = ulapi_socket_get_client_id (port, hostname.c_str ());
   if (socket_fd < 0)
@@ -92,6 +135,7 @@ UsarsimInf::init (GenericInf * siblingIn)
       socket_fd = -1;
       return -1;
     }
+  ulapi_mutex_set_name (socket_mutex, "socket");
 
   ulapi_snprintf (str, sizeof (str),
 		  "GETSTARTPOSES\r\nINIT {Classname USARBot.%s} {Name %s} {Start %s}\r\n",
@@ -212,7 +256,7 @@ UsarsimInf::init (GenericInf * siblingIn)
 }
 
 int
-UsarsimInf::msgout (sw_struct * sw, componentInfo info)
+UsarsimInf::msgout (sw_struct * sw, const componentInfo & info)
 {
   if (sw->name == "")
     {
@@ -222,22 +266,351 @@ UsarsimInf::msgout (sw_struct * sw, componentInfo info)
   else
     {
       sw->time = info.time;
+      if (info.time <= 0.)
+	ROS_DEBUG ("Sensor msg class %s with operand %d without time",
+		   swTypeToString (sw->type), info.op);
       //      ROS_ERROR( "time: %f swtime: %f", info.time, sw->time );
       sw->op = info.op;
-      sibling->peerMsg (sw);
+      if (tracing)
+	{
+	  sw->trace.received = lineReceived;
+	  sw->trace.framed = lineFramed;
+	  sw->trace.parsed = ulapi_monotime ();
+	}
+      else
+	sw->trace.received = 0;
+      foldState (sw);
+      if (sw->type == SW_ROBOT_GROUNDVEHICLE && sw->op == SW_ROBOT_SET)
+	drive->configure (sw->data.groundvehicle);
+      if (pipeline != NULL)
+	{
+	  int shard = 0;
+	  int mailbox = -1;
+
+	  // components keep the worker they were first given
+	  if (info.where != NULL && info.where != &info.def)
+	    {
+	      shard = info.where->getShard ();
+	      if (shard < 0)
+		{
+		  shard = pipeline->assignShard (sw->type);
+		  info.where->setShard (shard);
+		}
+	      if (queuePolicy (info.where, sw) == USARSIM_QUEUE_LATEST)
+		{
+		  mailbox = info.where->getMailbox ();
+		  if (mailbox < 0)
+		    {
+		      mailbox = pipeline->addMailbox (sw->name);
+		      info.where->setMailbox (mailbox);
+		    }
+		}
+	    }
+	  return pipeline->push (sw, shard, mailbox);
+	}
+      if (tracing)
+	{
+	  sw->trace.peer = ulapi_monotime ();
+	  sibling->peerMsg (sw);
+	  trace.record (sw, ulapi_monotime ());
+	}
+      else
+	sibling->peerMsg (sw);
     }
   return 1;
 }
 
+/*
+  Move the sibling's message handling onto /usarsim/publishWorkers
+  threads, each fed by a ring of /usarsim/ringSize parsed messages.
+  Without this, msgout calls the sibling directly from the socket thread.
+  A ring size of 0 keeps it that way. /usarsim/publishCpu pins worker n
+  to that cpu plus n, and /usarsim/publishFifo runs them as SCHED_FIFO.
+*/
+int
+UsarsimInf::startPipeline ()
+{
+  int ringSize;
+  int workers;
+  bool reportStats;
+  int firstCpu;
+  bool fifo;
+
+  if (pipeline != NULL)
+    return 1;
+  nh->param < int >("/usarsim/ringSize", ringSize, 256);
+  ROS_DEBUG ("parameter /usarsim/ringSize: %d", ringSize);
+  if (ringSize <= 0)
+    return 1;
+  nh->param < int >("/usarsim/publishWorkers", workers, 3);
+  ROS_DEBUG ("parameter /usarsim/publishWorkers: %d", workers);
+  nh->param < bool > ("/usarsim/pipelineStats", reportStats, false);
+  nh->param < int >("/usarsim/publishCpu", firstCpu, -1);
+  nh->param < bool > ("/usarsim/publishFifo", fifo, false);
+
+  pipeline = new UsarsimPipeline (sibling, workers, ringSize);
+  pipeline->reportStats = reportStats;
+  pipeline->firstCpu = firstCpu;
+  pipeline->fifo = fifo;
+  pipeline->tracing = tracing;
+  pipeline->traceReport = tracing ? traceReport : 0;
+  if (pipeline->start () != 1)
+    {
+      delete pipeline;
+      pipeline = NULL;
+      return -1;
+    }
+  return 1;
+}
+
+/*
+  How this message reaches its worker. Configuration, geometry and
+  settings are always queued. Status goes by the component's policy:
+  range scans, object sweeps and the messages that only update a pose
+  (robot, INS, odometry, gripper and toolchanger state) keep just the
+  newest, while actuator status and range imager frames, which build on
+  each other, are all queued. /usarsim/queuePolicy/<name> set to "all"
+  or "latest" overrides the default for one component.
+*/
+int
+UsarsimInf::queuePolicy (UsarsimList * where, const sw_struct * sw)
+{
+  int policy = where->getQueuePolicy ();
+  std::string param;
+  std::string value;
+  std::string error;
+
+  if (policy < 0)
+    {
+      switch (sw->type)
+	{
+	case SW_SEN_RANGESCANNER:
+	case SW_SEN_OBJECTSENSOR:
+	case SW_SEN_INS:
+	case SW_SEN_ODOMETER:
+	case SW_EFF_GRIPPER:
+	case SW_EFF_TOOLCHANGER:
+	case SW_ROBOT_FIXED:
+	case SW_ROBOT_GROUNDVEHICLE:
+	  policy = USARSIM_QUEUE_LATEST;
+	  break;
+	default:
+	  policy = USARSIM_QUEUE_ALL;
+	  break;
+	}
+      param = "/usarsim/queuePolicy/" + sw->name;
+      if (ros::names::validate (param, error)
+	  && nh->getParam (param, value))
+	{
+	  if (value == "all")
+	    policy = USARSIM_QUEUE_ALL;
+	  else if (value == "latest")
+	    policy = USARSIM_QUEUE_LATEST;
+	  else
+	    ROS_WARN ("usarsimInf: unknown %s \"%s\", use \"all\" or \"latest\"",
+		      param.c_str (), value.c_str ());
+	}
+      ROS_DEBUG ("usarsimInf: %s status queue policy %s", sw->name.c_str (),
+		 policy == USARSIM_QUEUE_LATEST ? "latest" : "all");
+      where->setQueuePolicy (policy);
+    }
+
+  switch (sw->type)
+    {
+    case SW_ROBOT_GROUNDVEHICLE:
+    case SW_ROBOT_AIRBOT:
+      return sw->op == SW_ROBOT_STAT ? policy : USARSIM_QUEUE_ALL;
+    case SW_ACT:
+      return sw->op == SW_ACT_STAT ? policy : USARSIM_QUEUE_ALL;
+    case SW_ROBOT_FIXED:	// fixed robots report status as devices do
+    default:
+      return sw->op == SW_DEVICE_STAT ? policy : USARSIM_QUEUE_ALL;
+    }
+}
+
+void
+UsarsimInf::stopPipeline ()
+{
+  if (pipeline == NULL)
+    return;
+  pipeline->stop ();
+  ulapi_mutex_take (traceMutex);
+  delete pipeline;
+  pipeline = NULL;
+  ulapi_mutex_give (traceMutex);
+}
+
+/*
+  Log the latency of every traced component: how long its messages took
+  to come off the socket, be parsed, wait for a publish thread and be
+  published. The same report is made every /usarsim/traceReport seconds.
+*/
+bool
+UsarsimInf::dumpLatencyCallback (std_srvs::Empty::Request & req,
+				 std_srvs::Empty::Response & res)
+{
+  ulapi_mutex_take (traceMutex);
+  if (pipeline != NULL)
+    pipeline->logTrace ("requested");
+  else
+    trace.report ("socket thread", "requested");
+  ulapi_mutex_give (traceMutex);
+  return true;
+}
+
+bool
+UsarsimInf::clearLatencyCallback (std_srvs::Empty::Request & req,
+				  std_srvs::Empty::Response & res)
+{
+  ulapi_mutex_take (traceMutex);
+  if (pipeline != NULL)
+    pipeline->clearTrace ();
+  trace.clear ();
+  ulapi_mutex_give (traceMutex);
+  return true;
+}
+
+/*
+  Send cmd_vel to the simulator from a task of its own, at
+  /usarsim/driveRate Hz (0 sends each one as it arrives), stopping the
+  vehicle after /usarsim/driveTimeout seconds without one.
+  /usarsim/driveCpu and /usarsim/driveFifo place the task.
+*/
+int
+UsarsimInf::startDrive ()
+{
+  double rate;
+  double timeout;
+  int cpu;
+  bool fifo;
+
+  nh->param < double >("/usarsim/driveRate", rate, 20.);
+  nh->param < double >("/usarsim/driveTimeout", timeout, 0.5);
+  nh->param < int >("/usarsim/driveCpu", cpu, -1);
+  nh->param < bool > ("/usarsim/driveFifo", fifo, false);
+  ROS_DEBUG ("parameter /usarsim/driveRate: %f", rate);
+  return drive->start (rate, timeout, cpu, fifo);
+}
+
+void
+UsarsimInf::stopDrive ()
+{
+  drive->stop ();
+}
+
+static void
+stateName (char *dst, const std::string & name)
+{
+  strncpy (dst, name.c_str (), SW_NAME_MAX - 1);
+  dst[SW_NAME_MAX - 1] = 0;
+}
+
+/*
+  Fold one parsed message into the socket thread's copy of the robot
+  state. Only the socket thread touches stateWork.
+*/
+void
+UsarsimInf::foldState (const sw_struct * sw)
+{
+  RobotStateSnapshot & s = stateWork;
+  int i;
+
+  s.messages++;
+  if (sw->time > s.time)
+    s.time = sw->time;
+  stateDirty = true;
+  switch (sw->type)
+    {
+    case SW_ROBOT_FIXED:
+      stateName (s.platformName, sw->name);
+      break;
+    case SW_ROBOT_GROUNDVEHICLE:
+      stateName (s.platformName, sw->name);
+      s.length = sw->data.groundvehicle.length;
+      s.width = sw->data.groundvehicle.width;
+      s.height = sw->data.groundvehicle.height;
+      s.steerType = sw->data.groundvehicle.steertype;
+      s.speed = sw->data.groundvehicle.speed;
+      s.heading = sw->data.groundvehicle.heading;
+      break;
+    case SW_SEN_INS:
+    case SW_SEN_ODOMETER:
+      if (sw->op != SW_SEN_INS_STAT && sw->op != SW_SEN_ODOMETER_STAT)
+	break;
+      if (!stateOdomName.empty () && sw->name != stateOdomName)
+	break;
+      stateName (s.poseSource, sw->name);
+      s.poseTime = sw->time;
+      s.pose = sw->type == SW_SEN_INS ? sw->data.ins.position :
+	sw->data.odometer.position;
+      break;
+    case SW_ACT:
+      if (sw->op != SW_ACT_STAT)
+	break;
+      for (i = 0; i < s.actuators; i++)
+	if (!strncmp (s.actuator[i].name, sw->name.c_str (), SW_NAME_MAX - 1))
+	  break;
+      if (i == USARSIM_STATE_ACTUATOR_MAX)
+	break;
+      if (i == s.actuators)
+	{
+	  stateName (s.actuator[i].name, sw->name);
+	  s.actuators++;
+	}
+      s.actuator[i].time = sw->time;
+      s.actuator[i].number = sw->data.actuator.number;
+      if (s.actuator[i].number > SW_ACT_LINK_MAX)
+	s.actuator[i].number = SW_ACT_LINK_MAX;
+      for (int link = 0; link < s.actuator[i].number; link++)
+	s.actuator[i].position[link] = sw->data.actuator.link[link].position;
+      break;
+    case SW_EFF_GRIPPER:
+    case SW_EFF_TOOLCHANGER:
+      if (sw->op != SW_EFF_GRIPPER_STAT && sw->op != SW_EFF_TOOLCHANGER_STAT)
+	break;
+      for (i = 0; i < s.effectors; i++)
+	if (!strncmp (s.effector[i].name, sw->name.c_str (), SW_NAME_MAX - 1))
+	  break;
+      if (i == USARSIM_STATE_EFFECTOR_MAX)
+	break;
+      if (i == s.effectors)
+	{
+	  stateName (s.effector[i].name, sw->name);
+	  s.effector[i].type = sw->type;
+	  s.effectors++;
+	}
+      s.effector[i].time = sw->time;
+      if (sw->type == SW_EFF_GRIPPER)
+	s.effector[i].status = sw->data.gripper.status;
+      else
+	{
+	  s.effector[i].status = sw->data.toolchanger.status;
+	  s.effector[i].tooltype = sw->data.toolchanger.tooltype;
+	}
+      break;
+    default:
+      break;
+    }
+}
+
+unsigned long
+UsarsimInf::readState (RobotStateSnapshot & stateOut)
+{
+  return state.read (stateOut);
+}
+
+void
+UsarsimInf::writeCommand (const char *str)
+{
+  ulapi_mutex_take (socket_mutex);
+  usarsim_socket_write (socket_fd, (char *) str, strlen (str));
+  ulapi_mutex_give (socket_mutex);
+}
+
 int
 UsarsimInf::peerMsg (sw_struct * swIn)
 {
   char str[MAX_MSG_LEN];
-  sw_struct *sw;
-  double turnRadius;
-  double leftVel, rightVel;
-  double steerAngle, vehVel;
-  double scale;
   std::string command;
   std::stringstream tempSS;
   /*
@@ -250,121 +623,8 @@ UsarsimInf::peerMsg (sw_struct * swIn)
   switch (swIn->type)
     {
     case SW_ROS_CMD_VEL:
-      sw = robot->getSW ();
-      if (sw->type == SW_ROBOT_GROUNDVEHICLE)
-	{
-	  /* equations of motion:
-	     SL = rTh
-	     SR = (r + b)Th
-	     SM = (r +b/2)Th
-	   */
-	  if (sw->data.groundvehicle.steertype == SW_STEER_SKID)
-	    {
-	      if (swIn->data.roscmdvel.lineary != 0
-		  || swIn->data.roscmdvel.linearz != 0)
-		{
-		  ROS_WARN ("Invalid skid steering message <%f %f %f>",
-			    swIn->data.roscmdvel.linearx,
-			    swIn->data.roscmdvel.lineary,
-			    swIn->data.roscmdvel.linearz);
-		}
-	      if (swIn->data.roscmdvel.angularz != 0)
-		{
-		  turnRadius =
-		    swIn->data.roscmdvel.linearx /
-		    swIn->data.roscmdvel.angularz -
-		    sw->data.groundvehicle.wheel_separation / 2.;
-		  leftVel = turnRadius * swIn->data.roscmdvel.angularz;
-		  rightVel = (turnRadius +
-			      sw->data.groundvehicle.wheel_separation) *
-		    swIn->data.roscmdvel.angularz;
-		}
-	      else
-		{
-		  leftVel = swIn->data.roscmdvel.linearx;
-		  rightVel = swIn->data.roscmdvel.linearx;
-		}
-	      leftVel /= sw->data.groundvehicle.wheel_radius;
-	      rightVel /= sw->data.groundvehicle.wheel_radius;
-	      if (leftVel > sw->data.groundvehicle.max_speed)
-		{
-		  scale = sw->data.groundvehicle.max_speed / leftVel;
-		  ROS_WARN ("Left wheel spin speed too high! Scaling by %f%%",	// note that %% prints %
-			    100 * scale);
-		  leftVel = sw->data.groundvehicle.max_speed;
-		  rightVel *= scale;
-		}
-	      if (rightVel > sw->data.groundvehicle.max_speed)
-		{
-		  scale = sw->data.groundvehicle.max_speed / rightVel;
-		  ROS_WARN
-		    ("Right wheel spin speed too high! Scaling by %f%%",
-		     100. * scale);
-		  rightVel = sw->data.groundvehicle.max_speed;
-		  leftVel *= scale;
-		}
-	      /*
-	      ROS_INFO
-		("Sent skid steering with sep: %f radius: %f and vel <%f %f>",
-		 sw->data.groundvehicle.wheel_separation,
-		 sw->data.groundvehicle.wheel_radius, leftVel, rightVel);
-	      */
-	      ulapi_snprintf (str, sizeof (str),
-			      "Drive {Left %f} {Right %f}\r\n", leftVel,
-			      rightVel);
-	      NULLTERM (str);
-	      ulapi_mutex_take (socket_mutex);
-	      usarsim_socket_write (socket_fd, str, strlen (str));
-	      ulapi_mutex_give (socket_mutex);
-	    }
-	  else if (sw->data.groundvehicle.steertype == SW_STEER_ACKERMAN)
-	    {
-	      if (swIn->data.roscmdvel.lineary != 0
-		  || swIn->data.roscmdvel.linearz != 0
-		  || swIn->data.roscmdvel.angularx != 0
-		  || swIn->data.roscmdvel.angulary != 0)
-		{
-		  ROS_WARN ("Invalid skid steering message <%f %f %f> <%f %f %f>",
-			    swIn->data.roscmdvel.linearx,
-			    swIn->data.roscmdvel.lineary,
-			    swIn->data.roscmdvel.linearz,
-			    swIn->data.roscmdvel.angularx,
-			    swIn->data.roscmdvel.angulary,
-			    swIn->data.roscmdvel.angularz);
-		}
-	      if( swIn->data.roscmdvel.linearx == 0 )
-		{
-		  steerAngle = swIn->data.roscmdvel.angularz;
-		  vehVel = 0.;
-		}
-	      else
-		{
-		  steerAngle = atan2(swIn->data.roscmdvel.angularz *
-				     sw->data.groundvehicle.wheel_base,
-				     swIn->data.roscmdvel.linearx);
-		  vehVel = swIn->data.roscmdvel.linearx/cos(steerAngle);
-		}
-	      // fixeme! How do I know if it is front or rear steer?
-	      ulapi_snprintf (str, sizeof (str),
-			      "Drive {Speed %f} {FrontSteer %f} {RearSteer %f}\r\n", 
-			      vehVel, steerAngle, steerAngle );
-	      NULLTERM (str);
-	      ulapi_mutex_take (socket_mutex);
-	      usarsim_socket_write (socket_fd, str, strlen (str));
-	      ulapi_mutex_give (socket_mutex);
-	      ROS_ERROR ("Wrote %s", str );
-	    }
-	  else
-	    {
-	      ROS_ERROR ("Currently only support skid steered and Ackerman steeredrobots");
-	      break;
-	    }
-	}
-      else
-	{
-	  ROS_ERROR ("Currently only support ground robot");
-	  break;
-	}
+      // newest wins; the drive task sends it at /usarsim/driveRate
+      drive->command (swIn->data.roscmdvel);
 
       /*
          case SW_ROBOT_ACKERMAN_MOVE:
@@ -406,6 +666,7 @@ UsarsimInf::peerMsg (sw_struct * swIn)
       	ulapi_snprintf(str, sizeof(str), "SET {Type Gripper} {Name %s} {Opcode %s}\r\n", 
       	swIn->name.c_str(), command.c_str());
       	NULLTERM(str);
+      	ulapi_mutex_take (socket_mutex);
       	usarsim_socket_write (socket_fd, str, strlen (str));
 		ulapi_mutex_give (socket_mutex);
       break;
@@ -417,6 +678,7 @@ UsarsimInf::peerMsg (sw_struct * swIn)
       	ulapi_snprintf(str, sizeof(str), "SET {Type ToolChanger} {Name %s} {Opcode %s}\r\n", 
       	swIn->name.c_str(), command.c_str());
       	NULLTERM(str);
+      	ulapi_mutex_take (socket_mutex);
       	usarsim_socket_write (socket_fd, str, strlen (str));
 		ulapi_mutex_give (socket_mutex);
       break; 
@@ -424,6 +686,7 @@ UsarsimInf::peerMsg (sw_struct * swIn)
       ulapi_snprintf(str, sizeof(str), "SET {Type RangeImager} {Name %s} {Opcode SCAN}\r\n",
       swIn->name.c_str());
       NULLTERM(str);
+      ulapi_mutex_take (socket_mutex);
       usarsim_socket_write(socket_fd, str, strlen (str));
 		ulapi_mutex_give (socket_mutex);
       break;
@@ -612,6 +875,18 @@ ulapi_integer
   return ulapi_socket_write (id, buf, len);
 }
 
+/*
+  The socket stays open for the commands still being written; only the
+  reading side is shut down, which wakes a read blocked on it.
+*/
+void
+UsarsimInf::stopSocket ()
+{
+  __atomic_store_n (&stopped, true, __ATOMIC_RELEASE);
+  if (socket_fd >= 0)
+    ulapi_socket_shutdown_read (socket_fd);
+}
+
 int
 UsarsimInf::msgIn ()
 {
@@ -621,7 +896,10 @@ UsarsimInf::msgIn ()
   ptrdiff_t offset;
   int nchars;
   int err;
+  double readTime;
 
+  if (socketStopped ())
+    return -1;
   nchars = ulapi_socket_read (socket_fd, buffer, BUFFERLEN);
   if (nchars == -1)
     {				/* bad read */
@@ -631,12 +909,14 @@ UsarsimInf::msgIn ()
     {				/* end of file */
       return -1;
     }
+  readTime = tracing ? ulapi_monotime () : 0;
   buffer_ptr = buffer;
   buffer_end = buffer + nchars;
 
   while (buffer_ptr != buffer_end)
     {
-      if (build_ptr == build_end)
+      // leave room for the character and the terminating null
+      if (build_end - build_ptr < 2)
 	{
 	  offset = build_ptr - build;
 	  buildlen *= 2;
@@ -644,9 +924,14 @@ UsarsimInf::msgIn ()
 	  build_ptr = build + offset;
 	  build_end = build + buildlen;
 	}
+      // a line is received when its first bytes are
+      if (build_ptr == build)
+	lineReceived = readTime;
       *build_ptr++ = *buffer_ptr;
       if (*buffer_ptr++ == DELIMITER)
 	{
+	  if (tracing)
+	    lineFramed = ulapi_monotime ();
 	  offset = build_ptr - build;
 	  build_ptr = build;
 	  build[offset] = 0;
@@ -656,6 +941,21 @@ UsarsimInf::msgIn ()
 	    }
 	}
     }
+  // without publish threads the sibling's output is batched per read
+  if (pipeline == NULL)
+    sibling->peerFlush ();
+  // readers see the whole read at once
+  if (stateDirty)
+    {
+      state.write (stateWork);
+      stateDirty = false;
+    }
+  if (tracing && pipeline == NULL && traceReport > 0
+      && ulapi_time () - lastTraceReport >= traceReport)
+    {
+      trace.report ("socket thread", "periodic");
+      lastTraceReport = ulapi_time ();
+    }
   return 1;
 }
 
@@ -1217,7 +1517,10 @@ UsarsimInf::handleSenRangeimager (char *msg)
 		}
 	      if (sscanf (info.token, "%f", &f) != 1)
 		return -1;
-	      if (number >= SW_SEN_RANGEIMAGER_MAX)
+	      if (number >= sw->data.rangeimager.capacity &&
+		  !SW_PAYLOAD_RESERVE (sw->data.rangeimager.range,
+				       sw->data.rangeimager.capacity,
+				       number + 1))
 		{
 		  // drop it 
 		  ROS_WARN ("rangeimager warning, dropping data");
@@ -2083,9 +2386,13 @@ UsarsimInf::handleSenRangescanner (char *msg)
 		}
 	      if (sscanf (info.token, "%lf", &d) != 1)
 		return -1;
-	      if (number >= SW_SEN_RANGESCANNER_MAX)
+	      if (number >= sw->data.rangescanner.capacity &&
+		  !SW_PAYLOAD_RESERVE (sw->data.rangescanner.range,
+				       sw->data.rangescanner.capacity,
+				       number + 1))
 		{
 		  // drop it 
+		  ROS_WARN ("rangescanner warning, dropping data");
 		}
 	      else
 		{
@@ -2139,16 +2446,17 @@ int UsarsimInf::handleSenObjectSensor(char *msg)
 		}else if(!strcmp(info.token, "Object"))
 		{
 			objectIndex++;
-			if(objectIndex >= SW_SEN_RANGESCANNER_MAX)
+			if(!SW_PAYLOAD_RESERVE(sw->data.objectsensor.objects,
+					       sw->data.objectsensor.capacity,
+					       objectIndex + 1))
 			{
+				ROS_ERROR("objectsensor error, no room for object %d", objectIndex);
+				return -1;
 			}
-			else
-			{
-				info.nextptr = getValue (info.ptr, info.token);
-		  		if (info.nextptr == info.ptr)
-					return -1;
-				strcpy(sw->data.objectsensor.objects[objectIndex].tag, info.token);
-	    	}
+			info.nextptr = getValue (info.ptr, info.token);
+			if (info.nextptr == info.ptr)
+				return -1;
+			strcpy(sw->data.objectsensor.objects[objectIndex].tag, info.token);
 		}
 		else if (!strcmp(info.token, "Location"))
 		{
@@ -2176,6 +2484,8 @@ int UsarsimInf::handleSenObjectSensor(char *msg)
 		}
 		else if (!strcmp(info.token, "Material"))
 		{
+			if(objectIndex < 0)
+				return -1;
 			info.nextptr = getValue (info.ptr, info.token);
 			if (info.nextptr == info.ptr)
 				return -1;
@@ -2438,6 +2748,14 @@ UsarsimInf::handleConfRangeimager (char *msg)
 	}
     }
 
+  // size the range buffer for a whole image, so that any framing works
+  if (!SW_PAYLOAD_RESERVE (sw->data.rangeimager.range,
+			   sw->data.rangeimager.capacity,
+			   (int) (sw->data.rangeimager.resolutionx *
+				  sw->data.rangeimager.resolutiony)))
+    ROS_ERROR ("rangeimager error, unable to reserve %d x %d ranges",
+	       (int) sw->data.rangeimager.resolutionx,
+	       (int) sw->data.rangeimager.resolutiony);
   info.op = SW_SEN_RANGEIMAGER_SET;
   info.where->setDidConf (1);
   msgout (sw, info);
@@ -2496,6 +2814,14 @@ UsarsimInf::handleConfRangescanner (char *msg)
 	}
     }
 
+  // one range per resolution step across the field of view
+  if (sw->data.rangescanner.resolution > 0 &&
+      !SW_PAYLOAD_RESERVE (sw->data.rangescanner.range,
+			   sw->data.rangescanner.capacity,
+			   (int) (sw->data.rangescanner.fov /
+				  sw->data.rangescanner.resolution + 1.5)))
+    ROS_ERROR ("rangescanner error, unable to reserve ranges for %s",
+	       sw->name.c_str ());
   info.where->setDidConf (1);
   info.op = SW_SEN_RANGESCANNER_SET;
   msgout (sw, info);
@@ -3307,6 +3633,11 @@ int UsarsimInf::handleConfObjectsensor(char *msg)
 	}
     }
 
+  if (!SW_PAYLOAD_RESERVE (sw->data.objectsensor.objects,
+			   sw->data.objectsensor.capacity,
+			   SW_SEN_OBJECTSENSOR_INITIAL))
+    ROS_ERROR ("objectsensor error, unable to reserve objects for %s",
+	       sw->name.c_str ());
   info.where->setDidConf (1);
   info.op = SW_SEN_OBJECTSENSOR_SET;
   msgout (sw, info);
@@ -30,10 +30,14 @@
 #ifndef __usarsimInf__
 #define __usarsimInf__
 #include <ros/ros.h>
+#include <std_srvs/Empty.h>
 #include "simware.hh"
 #include "usarsimMisc.hh"
 #include "genericInf.hh"
 #include "ulapi.hh"
+#include "usarsimPipeline.hh"
+#include "usarsimDrive.hh"
+#include "usarsimTrace.hh"
 
 #define SOCKET_MUTEX_KEY 1
 #define DELIMITER 10
@@ -41,7 +45,7 @@
 #define MAX_TOKEN_LEN 1024
 /* only works with arrays, not heap */
 #define NULLTERM(s) (s)[sizeof(s)-1]=0
-#define BUFFERLEN 8
+#define BUFFERLEN 4096
 
 //////////////////////////////////////////////
 // structures
@@ -66,6 +70,7 @@ class UsarsimInf:public GenericInf
 {
 public:
   UsarsimInf ();
+  ~UsarsimInf ();
   int init (GenericInf * siblingIn);
   int tell (sw_struct * sw, componentInfo info);
   int ask ();
@@ -77,19 +82,60 @@ public:
   double getReal (componentInfo * info);
   void getTime (componentInfo * info);
   int msgIn ();
-  int msgout (sw_struct * sw, componentInfo info);
+  //! any thread; makes a blocked msgIn return, and every later one fail
+  void stopSocket ();
+  bool socketStopped ()
+  {
+    return __atomic_load_n (&stopped, __ATOMIC_ACQUIRE);
+  }
+  int msgout (sw_struct * sw, const componentInfo & info);
+  int queuePolicy (UsarsimList * where, const sw_struct * sw);
   int peerMsg (sw_struct * sw);
+  unsigned long readState (RobotStateSnapshot & stateOut);
+  int startPipeline ();
+  void stopPipeline ();
+  int startDrive ();
+  void stopDrive ();
+  //! write one command line to the simulator
+  void writeCommand (const char *str);
 
 private:
   int waitingForConf;
   int waitingForGeo;
   int socket_fd;
   void *socket_mutex;
+  bool stopped;			/* stopSocket was called */
   int buildlen;
   char *build;
   char *build_ptr;
   char *build_end;
   char str[MAX_MSG_LEN];
+  /* parsed messages go to the sibling through here, if it is running */
+  UsarsimPipeline *pipeline;
+  /* turns cmd_vel into Drive commands */
+  UsarsimDrive *drive;
+  /* latency tracing, /usarsim/trace */
+  bool tracing;
+  double traceReport;		/* seconds between reports, /usarsim/traceReport */
+  double lastTraceReport;
+  double lineReceived;		/* when the first bytes of the line being built were read */
+  double lineFramed;		/* when its delimiter was */
+  /* latency of what the socket thread publishes itself, without a pipeline */
+  UsarsimTraceTable trace;
+  /* keeps the pipeline around while its latency is reported */
+  void *traceMutex;
+  ros::ServiceServer dumpLatencyService;
+  ros::ServiceServer clearLatencyService;
+  bool dumpLatencyCallback (std_srvs::Empty::Request & req,
+			    std_srvs::Empty::Response & res);
+  bool clearLatencyCallback (std_srvs::Empty::Request & req,
+			     std_srvs::Empty::Response & res);
+  /* robot state as of the last message parsed, published once per read */
+  RobotStateSnapshot stateWork;
+  bool stateDirty;
+  std::string stateOdomName;
+  UsarsimSeqlock < RobotStateSnapshot > state;
+  void foldState (const sw_struct * sw);
   /* list to hold all of the sensors */
   UsarsimList *encoders;
   UsarsimList *sonars;
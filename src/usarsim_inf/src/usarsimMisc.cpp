@@ -26,16 +26,11 @@
   \author Stephen Balakirsky
   \date   October 19, 2011
 */
+#include <math.h>
+#include <string.h>
+#include <sensor_msgs/image_encodings.h>
 #include "usarsimMisc.hh"
 
-////////////////////////////////////////////////////////////////////////
-// TrajectoryPoint
-////////////////////////////////////////////////////////////////////////
-TrajectoryPoint::TrajectoryPoint()
-{
-}
-
-
 ////////////////////////////////////////////////////////////////////////
 // UsarsimList
 ////////////////////////////////////////////////////////////////////////
@@ -45,8 +40,13 @@ UsarsimList::UsarsimList (int typeIn)
   sw.op = SW_NONE;
   sw.type = typeIn;
   sw.name = "";
+  // payload pointers start out empty, see swPayloadReserve
+  memset (&sw.data, 0, sizeof (sw.data));
   didConfMsg = 0;
   didGeoMsg = 0;
+  shard = -1;
+  queuePolicy = -1;
+  mailbox = -1;
 }
 
 void
@@ -56,7 +56,7 @@ UsarsimList::setName (const char *name)
 }
 
 UsarsimList *
-UsarsimList::classFind (std::string name)
+UsarsimList::classFind (const char *name)
 {
   UsarsimList *ptr;
 
@@ -132,12 +132,114 @@ UsarsimFlippers::UsarsimFlippers ()
   flipperTrans.rotation = tf::createQuaternionMsgFromYaw (0.);
 }
 
+////////////////////////////////////////////////////////////////////////
+// UsarsimThrottle
+////////////////////////////////////////////////////////////////////////
+UsarsimThrottle::UsarsimThrottle ()
+{
+  configure (0, 1);
+}
+
+void
+UsarsimThrottle::configure (double maxRate, int decimationIn)
+{
+  period = maxRate > 0 ? 1. / maxRate : 0;
+  decimation = decimationIn > 1 ? decimationIn : 1;
+  count = 0;
+  due = 0;
+}
+
+/*
+  Each message let through makes the next one due a period later, rather
+  than a period after it arrived, so a 40 Hz sensor capped at 15 Hz gives
+  15 Hz and not every third message. After a gap the schedule restarts
+  instead of letting a burst through.
+*/
+bool
+UsarsimThrottle::pass (double now)
+{
+  if (++count < decimation)
+    return false;
+  if (period > 0)
+    {
+      if (now < due)
+	return false;
+      due += period;
+      if (due < now)
+	due = now + period;
+    }
+  count = 0;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimChangeFilter
+////////////////////////////////////////////////////////////////////////
+UsarsimChangeFilter::UsarsimChangeFilter ()
+{
+  configure (0);
+}
+
+void
+UsarsimChangeFilter::configure (double heartbeatIn)
+{
+  heartbeat = heartbeatIn;
+  sent = false;
+  last = 0;
+  lastSent = 0;
+}
+
+bool
+UsarsimChangeFilter::pass (long value, double now)
+{
+  if (heartbeat > 0 && sent && value == last && now - lastSent < heartbeat)
+    return false;
+  sent = true;
+  last = value;
+  lastSent = now;
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // UsarsimSensor
 ////////////////////////////////////////////////////////////////////////
 UsarsimSensor::UsarsimSensor ()
 {
   time = 0;
+  linkOffset = -1;
+  mountJoint = -1;
+  mountChanged = true;	// nothing sent yet
+  // components live for the whole run, so the mutex and counter are never deleted
+  stateMutex = ulapi_mutex_new (0);
+  subscribers = new int (0);
+  hasSide = false;
+  wanted = false;
+  sendFull = false;
+  sendSide = false;
+}
+
+bool
+UsarsimSensor::sample (double now)
+{
+  if (!hasSubscribers ())
+    {
+      sendFull = false;
+      sendSide = false;
+    }
+  else
+    {
+      sendFull = rate.pass (now);
+      sendSide = hasSide && sideRate.pass (now);
+    }
+  wanted = sendFull || sendSide;
+  return wanted;
+}
+
+void
+UsarsimSensor::countSubscriber (int *count, int delta,
+				const ros::SingleSubscriberPublisher &)
+{
+  __atomic_add_fetch (count, delta, __ATOMIC_RELAXED);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -176,10 +278,18 @@ UsarsimGripperEffector::UsarsimGripperEffector (GenericInf *parentInf):UsarsimSe
 }
 void UsarsimGripperEffector::commandCallback(const usarsim_inf::EffectorCommandConstPtr &msg)
 {
-	if(!commandActive)
+	bool accepted = false;
+	{
+		UsarsimMutexLock lock(stateMutex);
+		if(!commandActive)
+		{
+			commandActive = true;
+			goal.state = msg->state;
+			accepted = true;
+		}
+	}
+	if(accepted)
 	{
-		commandActive = true;
-		goal.state = msg->state;
 		ROS_INFO("Received gripper command, opcode %d", msg->state);
 		sw_struct newSw;
 		newSw.type = SW_ROS_CMD_GRIP;
@@ -197,6 +307,16 @@ bool UsarsimGripperEffector::isDone()
 		return true;
 	return false;
 }
+/*
+Called by the publish worker after each status; ends the active command once
+the gripper reaches its goal.
+*/
+void UsarsimGripperEffector::settleCommand()
+{
+	UsarsimMutexLock lock(stateMutex);
+	if(commandActive && isDone())
+		commandActive = false;
+}
 ////////////////////////////////////////////////////////////////////////
 // Range imager
 ////////////////////////////////////////////////////////////////////////
@@ -204,34 +324,293 @@ UsarsimRngImgSensor::UsarsimRngImgSensor (GenericInf *parentInf):UsarsimSensor (
 {
 	infHandle = parentInf;
 	ready = true;
+	complete = false;
 	lastFrameReceived = 0;
+	totalFrames = 0;
+	framesStored = 0;
+	assembling = false;
+	imageWidth = 0;
+	imageHeight = 0;
+	infoFov[0] = 0;
+	infoFov[1] = 0;
+	camInfo.width = 0;
+	camInfo.height = 0;
+	cloud = NULL;
+	continuous = false;
+	scanLead = 0;
+	scanTimeout = 0;
+	scanWanted = false;
+	lastActivity = 0;
+	scanStart = 0;
+	scans = 0;
+	scanTime = 0;
+	statStart = 0;
 }
 bool UsarsimRngImgSensor::isReady()
 {
+	UsarsimMutexLock lock(stateMutex);
 	return ready;
 }
 void UsarsimRngImgSensor::sentFrame(int frame)
 {
-	ROS_INFO("receiving frame %d of %d", frame, totalFrames);
+	ROS_DEBUG("receiving frame %d of %d", frame, totalFrames);
  	lastFrameReceived = frame;
  	if(lastFrameReceived == totalFrames - 1)
  	{
+ 		ulapi_mutex_take(stateMutex);
  		ready = true;
- 		ROS_INFO("RangeImager scan complete.");
+ 		ulapi_mutex_give(stateMutex);
+ 		if(framesStored != 0)
+ 		{
+ 			//storeFrame did not complete the scan, so a frame went missing;
+ 			//throw the partial scan away
+ 			ROS_WARN("RangeImager %s: scan ended with %d of %d frames, dropped.",
+ 				name.c_str(), framesStored, totalFrames);
+ 			framesReceived.assign(totalFrames, false);
+ 			framesStored = 0;
+ 		}
  	}
  	else
+ 	{
+ 		ulapi_mutex_take(stateMutex);
  		ready = false;
+ 		ulapi_mutex_give(stateMutex);
+ 	}
+}
+/*
+Size the scan buffer for a width x height scan split into the given number of
+frames. It is only reallocated if the imager geometry changes; the image
+messages it is swapped with come from imagePool and keep their buffers too, so
+steady state scanning never touches the heap.
+*/
+void UsarsimRngImgSensor::setGeometry(int width, int height, int frames)
+{
+	size_t size = sizeof(float) * width * height;
+
+	totalFrames = frames;
+	if(imageWidth == width && imageHeight == height &&
+	   (int)framesReceived.size() == frames)
+		return;
+	imageWidth = width;
+	imageHeight = height;
+	scanData.assign(size, 0);
+	framesReceived.assign(frames, false);
+	framesStored = 0;
+	complete = false;
+}
+/*
+Work out the camera info of an ideal pinhole camera with this resolution and
+field of view (radians), the range imager having no lens to speak of. It is
+only redone when the imager's configuration changes. If the simulator gives
+no usable field of view, that of the Kinect (58x45 degrees) is assumed.
+*/
+void UsarsimRngImgSensor::setCameraInfo(int width, int height, double fovx, double fovy)
+{
+	if((int)camInfo.width == width && (int)camInfo.height == height &&
+	   infoFov[0] == fovx && infoFov[1] == fovy)
+		return;
+	infoFov[0] = fovx;
+	infoFov[1] = fovy;
+	if(!(fovx > 0 && fovx < M_PI))
+	{
+		ROS_WARN("RangeImager %s: no usable field of view (%f), assuming a Kinect's", name.c_str(), fovx);
+		fovx = 58 * M_PI / 180;
+		fovy = 45 * M_PI / 180;
+	}
+	double fx = width / 2. / tan(fovx / 2);
+	//square pixels, unless the vertical field of view says otherwise
+	double fy = (fovy > 0 && fovy < M_PI) ? height / 2. / tan(fovy / 2) : fx;
+	double cx = (width - 1) / 2.;
+	double cy = (height - 1) / 2.;
+
+	camInfo.width = width;
+	camInfo.height = height;
+	camInfo.distortion_model = "plumb_bob";
+	camInfo.D.assign(5, 0.);
+	camInfo.K.assign(0.);
+	camInfo.K[0] = fx;
+	camInfo.K[2] = cx;
+	camInfo.K[4] = fy;
+	camInfo.K[5] = cy;
+	camInfo.K[8] = 1;
+	camInfo.R.assign(0.);
+	camInfo.R[0] = camInfo.R[4] = camInfo.R[8] = 1;
+	camInfo.P.assign(0.);
+	camInfo.P[0] = fx;
+	camInfo.P[2] = cx;
+	camInfo.P[5] = fy;
+	camInfo.P[6] = cy;
+	camInfo.P[10] = 1;
+	camInfo.binning_x = 0;
+	camInfo.binning_y = 0;
+	camInfo.roi.x_offset = 0;
+	camInfo.roi.y_offset = 0;
+	camInfo.roi.height = 0;
+	camInfo.roi.width = 0;
+	camInfo.roi.do_rectify = false;
+	ROS_INFO("RangeImager %s: %dx%d, focal length %.2f x %.2f pixels",
+		name.c_str(), width, height, fx, fy);
+}
+/*
+Copy one frame of ranges into its slot of the scan being assembled. When the
+last missing frame arrives, the scan is swapped into a pooled image, which
+becomes depthImage, and that image's old buffer is reused for the next scan.
+Returns true if this frame completed a scan.
+*/
+bool UsarsimRngImgSensor::storeFrame(int frame, int offset, int count, const float *range)
+{
+	size_t start = sizeof(float) * (size_t)offset;
+	size_t bytes = sizeof(float) * (size_t)count;
+
+	if(frame < 0 || frame >= totalFrames || offset < 0 || count < 0 ||
+	   start + bytes > scanData.size())
+	{
+		ROS_ERROR("RangeImager %s: frame %d (%d ranges at %d) does not fit a %dx%d image",
+			name.c_str(), frame, count, offset, imageWidth, imageHeight);
+		return false;
+	}
+	memcpy(&scanData[start], range, bytes);
+	if(!framesReceived[frame])
+	{
+		framesReceived[frame] = true;
+		framesStored++;
+	}
+	if(framesStored < totalFrames)
+		return false;
+	//let go of the last image first, so the pool can hand it out again
+	depthImage.reset();
+	depthImage = imagePool.take();
+	depthImage->header.frame_id = imageFrame;
+	depthImage->width = imageWidth;
+	depthImage->height = imageHeight;
+	depthImage->step = sizeof(float) * imageWidth;
+	depthImage->encoding = sensor_msgs::image_encodings::TYPE_32FC1;
+	depthImage->data.swap(scanData);
+	scanData.resize(depthImage->data.size());
+	framesReceived.assign(totalFrames, false);
+	framesStored = 0;
+	complete = true;
+	ROS_DEBUG("RangeImager scan complete.");
+	return true;
+}
+/*
+Fill strip with the rows of one frame and stripInfo with the camera info,
+its ROI giving where those rows sit in the full image. Frames break on row
+boundaries; returns false for one that does not, or that does not fit.
+*/
+bool UsarsimRngImgSensor::makeStrip(int offset, int count, const float *range,
+				    sensor_msgs::Image &strip, sensor_msgs::CameraInfo &stripInfo)
+{
+	if(imageWidth <= 0 || offset < 0 || count <= 0 ||
+	   offset % imageWidth || count % imageWidth ||
+	   offset + count > imageWidth * imageHeight)
+	{
+		ROS_WARN_THROTTLE(5, "RangeImager %s: %d ranges at %d are not whole rows of a %dx%d image, no strip",
+			name.c_str(), count, offset, imageWidth, imageHeight);
+		return false;
+	}
+	strip.header.frame_id = imageFrame;
+	strip.width = imageWidth;
+	strip.height = count / imageWidth;
+	strip.step = sizeof(float) * imageWidth;
+	strip.encoding = sensor_msgs::image_encodings::TYPE_32FC1;
+	strip.is_bigendian = false;
+	strip.data.resize(sizeof(float) * count);
+	memcpy(&strip.data[0], range, sizeof(float) * count);
+	stripInfo = camInfo;
+	stripInfo.roi.x_offset = 0;
+	stripInfo.roi.y_offset = offset / imageWidth;
+	stripInfo.roi.width = strip.width;
+	stripInfo.roi.height = strip.height;
+	return true;
+}
+/*
+Returns true once for every scan completed by storeFrame.
+*/
+bool UsarsimRngImgSensor::scanComplete()
+{
+	bool retValue = complete;
+	complete = false;
+	return retValue;
 }
 void UsarsimRngImgSensor::commandCallback(const usarsim_inf::RangeImageScanConstPtr &msg)
 {
-	if(ready)
+	if(isReady())
+		sendScan();
+}
+void UsarsimRngImgSensor::sendScan()
+{
+	sw_struct newSw;
+	newSw.type = SW_ROS_CMD_SCAN;
+	newSw.name = name;
+	newSw.data.roscmdscan.dummy = 1;
+	infHandle->sibling->peerMsg(&newSw);
+}
+void UsarsimRngImgSensor::setContinuous(double rate, int lead, double timeout)
+{
+	UsarsimMutexLock lock(stateMutex);
+	continuous = true;
+	scanRate.configure(rate, 1);
+	scanLead = lead > 0 ? lead : 0;
+	scanTimeout = timeout;
+	scanWanted = true; // the first scan goes out on the next poll
+}
+/*
+The next scan is asked for while the current one is still coming in, so the
+imager starts it as soon as it can and is never left idle waiting for the
+round trip. Scan durations are from frame 0 to the last frame, and are logged
+with the scan rate achieved every ten seconds.
+*/
+bool UsarsimRngImgSensor::nextScan(int frame, double now)
+{
+	UsarsimMutexLock lock(stateMutex);
+	int trigger = totalFrames - 1 - scanLead;
+
+	if(!continuous)
+		return false;
+	lastActivity = now;
+	if(frame == 0)
+		scanStart = now;
+	if(frame == totalFrames - 1)
 	{
-		sw_struct newSw;
-		newSw.type = SW_ROS_CMD_SCAN;
-		newSw.name = name;
-		newSw.data.roscmdscan.dummy = 1;
-		infHandle->sibling->peerMsg(&newSw);
+		if(statStart == 0)
+			statStart = scanStart;
+		scans++;
+		scanTime += now - scanStart;
+		if(now - statStart >= 10)
+		{
+			ROS_INFO("RangeImager %s: %.2f scans/s, %.3f s per scan", name.c_str(),
+				 scans / (now - statStart), scanTime / scans);
+			scans = 0;
+			scanTime = 0;
+			statStart = now;
+		}
+	}
+	if(frame == (trigger > 0 ? trigger : 0))
+		scanWanted = true;
+	return scanDue(now);
+}
+bool UsarsimRngImgSensor::pollScan(double now)
+{
+	UsarsimMutexLock lock(stateMutex);
+
+	if(!continuous)
+		return false;
+	if(!scanWanted && scanTimeout > 0 && now - lastActivity > scanTimeout)
+	{
+		ROS_WARN("RangeImager %s: no frames for %.1f s, asking for a scan again",
+			 name.c_str(), now - lastActivity);
+		scanWanted = true;
 	}
+	return scanDue(now);
+}
+bool UsarsimRngImgSensor::scanDue(double now)
+{
+	if(!scanWanted || !scanRate.pass(now))
+		return false;
+	scanWanted = false;
+	lastActivity = now;
+	return true;
 }
 ////////////////////////////////////////////////////////////////////////
 // Toolchanger
@@ -242,7 +621,9 @@ UsarsimToolchanger::UsarsimToolchanger (GenericInf *parentInf):UsarsimSensor ()
 }
 void UsarsimToolchanger::commandCallback(const usarsim_inf::EffectorCommandConstPtr &msg)
 {
+	ulapi_mutex_take(stateMutex);
 	goal.state = msg->state;
+	ulapi_mutex_give(stateMutex);
 	ROS_INFO("Received toolchanger command, opcode %d", msg->state);
 	sw_struct newSw;
 	newSw.type = SW_ROS_CMD_TOOLCHANGE;
@@ -285,86 +666,142 @@ UsarsimActuator::UsarsimActuator (GenericInf *parentInf):UsarsimSensor ()
 {
   infHandle = parentInf;
   
-  trajectoryServer = NULL;
-  // initialize cycle timer to contain 5 values
-  cycleTimer.cycleDeque.clear();
-  for( int count=0; count<5; count++)
-    cycleTimer.cycleDeque.push_back(0.);
-  cycleTimer.lastTime = ros::Time::now();
-  cycleTimer.cycleTime = 0;
-}
-
-UsarsimActuator::~UsarsimActuator()
-{
-	if(trajectoryServer)
-	{
-		delete trajectoryServer;
-		trajectoryServer = NULL;
-	}
+  numJoints = 0;
+  goalTolerance = 0.1;
+  goalTimeTolerance = 0.5;
 }
 
+/*
+Accept a new goal and fit its splines from where the arm is now. The
+trajectory task does the rest.
+*/
 void UsarsimActuator::trajectoryCallback()
 {
-  ROS_INFO("Starting a new arm trajectory...");
   control_msgs::FollowJointTrajectoryGoal newGoal = *(trajectoryServer->acceptNewGoal());
-  ros::Time currentTime = ros::Time::now();
-  TrajectoryPoint goal;
-    for(unsigned int pointCount=0; pointCount<newGoal.trajectory.points.size(); pointCount++)
-    {
-		goal.numJoints = newGoal.trajectory.joint_names.size();
-		for(unsigned int jointCount=0; jointCount<goal.numJoints; jointCount++)
-		{
-			goal.jointGoals[jointCount] = newGoal.trajectory.points[pointCount].positions[jointCount];
-			if(newGoal.goal_tolerance.size() > jointCount)
-			goal.tolerances[jointCount] = newGoal.goal_tolerance[jointCount].position;
-			else
-			goal.tolerances[jointCount] = 0.1; //default should be set through parameter
-		}
-		goal.time = currentTime + newGoal.trajectory.points[pointCount].time_from_start;
-		currentTrajectory.goals.push_back(goal);
-    }
+  control_msgs::FollowJointTrajectoryResult result;
+  RobotStateSnapshot state;
+  std::vector<double> start;
+  std::string error;
+  bool built = false;
+  double duration = 0;
 
-    // sbb debug!!! adding extra point
-    ros::Duration rosDelay(0.25);
-    goal.time += rosDelay;
-    currentTrajectory.goals.push_back(goal);
-    goal.time += rosDelay;
-    currentTrajectory.goals.push_back(goal);
-    // end of debug
-      
-    for(unsigned int jointCount=0; jointCount<goal.numJoints; jointCount++)
-      {
-	currentTrajectory.finalGoal.jointGoals[jointCount] = goal.jointGoals[jointCount]; 
-	currentTrajectory.finalGoal.tolerances[jointCount] = goal.tolerances[jointCount];
-      }
-	
-    goal = currentTrajectory.goals.front();
-    currentTrajectory.goals.pop_front();
-
-    sw_struct sw;
-    sw.type = SW_ROS_CMD_TRAJ;
-    sw.name = name;
-    sw.data.roscmdtraj.number = goal.numJoints;
-    for(unsigned int i = 0; i<goal.numJoints; i++)
+  // start from the newest status the simulator has sent
+  infHandle->sibling->readState(state);
+  for(int i = 0; i < state.actuators; i++)
+    if(name == state.actuator[i].name)
+      start.assign(state.actuator[i].position,
+		   state.actuator[i].position + state.actuator[i].number);
+  {
+    UsarsimMutexLock lock(stateMutex);
+    if(start.empty())
+      error = "no status from the actuator yet";
+    else
+      built = trajectory.build(newGoal, jointNames, start,
+			       goalTolerance, goalTimeTolerance, error);
+    if(built)
     {
-		// send first goal point to the robotic arm
-		sw.data.roscmdtraj.goal[i] = goal.jointGoals[i];
+      // a wall clock step would move the arm along the spline
+      trajectory.startTime = ulapi_monotime();
+      duration = trajectory.duration;
     }
-    infHandle->sibling->peerMsg(&sw);
+  }
+  if(!built)
+  {
+    ROS_ERROR("Rejected trajectory for %s: %s", name.c_str(), error.c_str());
+    result.error_code = result.INVALID_GOAL;
+    trajectoryServer->setAborted(result, error);
+    return;
+  }
+  ROS_INFO("Starting a new arm trajectory of %d points, %.2f s...",
+	   (int) newGoal.trajectory.points.size(), duration);
 }
 void UsarsimActuator::preemptCallback()
 {	
-	ROS_ERROR("Goal preempted!");
+	{
+		UsarsimMutexLock lock(stateMutex);
+		trajectory.active = false;
+	}
+	ROS_WARN("Goal preempted for %s", name.c_str());
+	trajectoryServer->setPreempted();
+}
+bool UsarsimActuator::sampleTrajectory(double now, sw_struct *sw)
+{
+	UsarsimMutexLock lock(stateMutex);
+	if(!trajectory.active)
+		return false;
+	sw->type = SW_ROS_CMD_TRAJ;
+	sw->name = name;
+	sw->data.roscmdtraj.number = trajectory.getLinks();
+	trajectory.sample(now - trajectory.startTime, sw->data.roscmdtraj.goal);
+	return true;
+}
+/*
+The goal succeeds once its last point is due and every link is within
+tolerance, and is aborted if that hasn't happened goal_time_tolerance
+later. The result is sent without stateMutex held, since actionlib calls
+our callbacks with its own lock held.
+*/
+void UsarsimActuator::updateTrajectoryStatus(const sw_struct *sw)
+{
+  control_msgs::FollowJointTrajectoryResult result;
+  double positions[SW_ACT_LINK_MAX];
+  int number = sw->data.actuator.number;
+  bool finished = false;
+  double t;
+  unsigned long samples;
+  double rms, worst, late;
+
+  if(number > SW_ACT_LINK_MAX)
+    number = SW_ACT_LINK_MAX;
+  for(int i = 0; i < number; i++)
+    positions[i] = sw->data.actuator.link[i].position;
+  {
+    UsarsimMutexLock lock(stateMutex);
+    if(!trajectory.active)
+      return;
+    t = ulapi_monotime() - trajectory.startTime;
+    trajectory.track(t, positions, number);
+    if(t >= trajectory.duration)
+    {
+      if(trajectory.atGoal(positions, number))
+      {
+	result.error_code = result.SUCCESSFUL;
+	finished = true;
+      }
+      else if(t > trajectory.duration + trajectory.goalTime)
+      {
+	result.error_code = result.GOAL_TOLERANCE_VIOLATED;
+	finished = true;
+      }
+    }
+    if(!finished)
+      return;
+    trajectory.active = false;
+    late = t - trajectory.duration;
+    samples = trajectory.trackSamples;
+    worst = trajectory.trackMax;
+    rms = samples ? sqrt(trajectory.trackSumSq / samples) : 0.;
+  }
+  if(result.error_code == result.SUCCESSFUL)
+    ROS_INFO("Trajectory succeeded after %.2f s; tracking error %.4f rms %.4f max over %lu statuses",
+	     t, rms, worst, samples);
+  else
+    ROS_ERROR("Trajectory aborted: arm position not at goal %.2f s after the last point; tracking error %.4f rms %.4f max over %lu statuses",
+	      late, rms, worst, samples);
+  setTrajectoryResult(result);
 }
-void UsarsimActuator::setUpTrajectory()
+/*
+Start the FollowJointTrajectory server for this actuator if it is not already
+running. Called once the actuator has its final place in the servo's storage.
+*/
+void UsarsimActuator::ensureTrajectoryServer()
 {
-	trajectoryServer = new actionlib::SimpleActionServer<control_msgs::FollowJointTrajectoryAction>(name + "_controller/follow_joint_trajectory/", false);
 	if(trajectoryServer)
-	{
-		trajectoryServer->registerGoalCallback(boost::bind(&UsarsimActuator::trajectoryCallback, this));
-		trajectoryServer->registerPreemptCallback(boost::bind(&UsarsimActuator::preemptCallback, this));
-		trajectoryServer->start();
-	}
+		return;
+	trajectoryServer.reset(new actionlib::SimpleActionServer<control_msgs::FollowJointTrajectoryAction>(*infHandle->getNH(), name + "_controller/follow_joint_trajectory/", false));
+	trajectoryServer->registerGoalCallback(boost::bind(&UsarsimActuator::trajectoryCallback, this));
+	trajectoryServer->registerPreemptCallback(boost::bind(&UsarsimActuator::preemptCallback, this));
+	trajectoryServer->start();
 	ROS_INFO("Started trajectory server for actuator %s", name.c_str());
 }
 bool UsarsimActuator::isTrajectoryActive()
@@ -29,7 +29,6 @@
 */
 #ifndef __usarsimMisc__
 #define __usarsimMisc__
-#include <deque>
 #include <ros/ros.h>
 #include <tf/transform_broadcaster.h>
 #include <nav_msgs/Odometry.h>
@@ -46,41 +45,70 @@
 #include <usarsim_inf/RangeImageScan.h>
 #include "simware.hh"
 #include "genericInf.hh"
+#include "ulapi.hh"
+#include "usarsimTrajectory.hh"
+#include "usarsimPool.hh"
 
 //using namespace std;
 
 ////////////////////////////////////////////////////////////////////////
-//TrajectoryPoint
+// UsarsimMutexLock
 ////////////////////////////////////////////////////////////////////////
-class TrajectoryPoint
+//! holds a ulapi mutex for the life of the object
+class UsarsimMutexLock
 {
 public:
-  TrajectoryPoint();
-  unsigned int numJoints;
-  double jointGoals[SW_ACT_LINK_MAX];
-  double tolerances[SW_ACT_LINK_MAX];
-  ros::Time time;
+  UsarsimMutexLock (void *mutexIn)
+  {
+    mutex = mutexIn;
+    ulapi_mutex_take (mutex);
+  }
+  ~UsarsimMutexLock ()
+  {
+    ulapi_mutex_give (mutex);
+  }
+private:
+  UsarsimMutexLock (const UsarsimMutexLock &);
+  UsarsimMutexLock & operator= (const UsarsimMutexLock &);
+  void *mutex;
 };
 
 ////////////////////////////////////////////////////////////////////////
-//Trajectory
+// UsarsimThrottle
 ////////////////////////////////////////////////////////////////////////
-class Trajectory
+//! lets through every decimation'th message, and no more than maxRate
+//! of those a second on average; maxRate 0 is no cap
+class UsarsimThrottle
 {
 public:
-  std::deque<TrajectoryPoint> goals;
-  TrajectoryPoint finalGoal;
+  UsarsimThrottle ();
+  void configure (double maxRate, int decimationIn);
+  //! whether the message at time now (seconds) goes out
+  bool pass (double now);
+private:
+  double period;
+  int decimation;
+  int count;			// messages seen since the last one let through
+  double due;			// time the next message may go out
 };
 
 ////////////////////////////////////////////////////////////////////////
-//Cycle timer
+// UsarsimChangeFilter
 ////////////////////////////////////////////////////////////////////////
-typedef struct CycleTimer
+//! lets a status through when its value differs from the last one let
+//! through, or heartbeat seconds after it; heartbeat 0 lets all through
+class UsarsimChangeFilter
 {
-  ros::Time lastTime;
-  double cycleTime;
-  std::deque <double> cycleDeque;
-}CycleTimer;
+public:
+  UsarsimChangeFilter ();
+  void configure (double heartbeatIn);
+  bool pass (long value, double now);
+private:
+  double heartbeat;
+  bool sent;			// whether anything has been let through
+  long last;
+  double lastSent;
+};
 
 ////////////////////////////////////////////////////////////////////////
 // UsarsimList
@@ -94,7 +122,7 @@ public:
   {
     return &sw;
   }
-  UsarsimList *classFind (std::string name);
+  UsarsimList *classFind (const char *name);
   int didConf ()
   {
     return didConfMsg;
@@ -115,11 +143,41 @@ public:
   {
     return next;
   }
+  //! publish worker that handles this component, -1 until assigned
+  int getShard ()
+  {
+    return shard;
+  }
+  void setShard (int value)
+  {
+    shard = value;
+  }
+  //! usarsimQueuePolicy for this component's status, -1 until decided
+  int getQueuePolicy ()
+  {
+    return queuePolicy;
+  }
+  void setQueuePolicy (int value)
+  {
+    queuePolicy = value;
+  }
+  //! pipeline mailbox for USARSIM_QUEUE_LATEST, -1 until assigned
+  int getMailbox ()
+  {
+    return mailbox;
+  }
+  void setMailbox (int value)
+  {
+    mailbox = value;
+  }
 
 private:
   sw_struct sw;
   int didConfMsg;
   int didGeoMsg;
+  int shard;
+  int queuePolicy;
+  int mailbox;
   UsarsimList *next;
 };
 
@@ -217,6 +275,35 @@ public:
   ros::Publisher pub;		// publisher for data
   geometry_msgs::TransformStamped tf;	// transform for sensor
   int linkOffset; //which link this component is mounted on. -1 if not parented to a link.  
+  int mountJoint; //index of this component's mount joint in the servo joint state, -1 if none
+  bool mountChanged; //tf moved since the static mount was last sent
+  //! guards the state a ROS callback shares with the publish worker
+  //! (command goals, trajectories, scan handshakes); copies share it
+  void *stateMutex;
+  //! subscribers to pub and any companion publisher, counted by the
+  //! publishers' connect and disconnect callbacks; copies share it
+  int *subscribers;
+  //! optional downsampled copy of pub, on <topic>_throttle
+  ros::Publisher sidePub;
+  UsarsimThrottle rate;		// caps pub
+  UsarsimThrottle sideRate;	// caps sidePub
+  UsarsimChangeFilter change;	// for status that mostly repeats
+  bool hasSide;
+  //! whether the message being handled has anyone to go to, and on which
+  //! publishers; sampled once per message so that building and
+  //! publishing agree
+  bool wanted;
+  bool sendFull;
+  bool sendSide;
+  //! decide, before building it, where the message at time now goes
+  bool sample (double now);
+  bool hasSubscribers () const
+  {
+    return __atomic_load_n (subscribers, __ATOMIC_RELAXED) > 0;
+  }
+  //! connect (delta 1) or disconnect (delta -1) callback for a publisher
+  static void countSubscriber (int *count, int delta,
+			       const ros::SingleSubscriberPublisher &);
 };
 
 ////////////////////////////////////////////////////////////////////////
@@ -238,28 +325,72 @@ class UsarsimRngScnSensor:public UsarsimSensor
 {
 public:
   UsarsimRngScnSensor ();
-  sensor_msgs::LaserScan scan;
+  boost::shared_ptr < sensor_msgs::LaserScan > scan; // last scan built, from scanPool
+  UsarsimPool < sensor_msgs::LaserScan > scanPool;
 };
 ////////////////////////////////////////////////////////////////////////
 // Range Imager
 ////////////////////////////////////////////////////////////////////////
+class UsarsimCloud;
 class UsarsimRngImgSensor:public UsarsimSensor
 {
 public:
   UsarsimRngImgSensor(GenericInf *parentInf);
   GenericInf *infHandle;
-  sensor_msgs::Image depthImage;
+  boost::shared_ptr<sensor_msgs::Image> depthImage; // last complete scan, ready to publish
+  UsarsimPool<sensor_msgs::Image> imagePool;
+  std::string imageFrame; // frame_id of the depth images
   int totalFrames;
   ros::Publisher cameraInfoPub;
   ros::Subscriber command;
-  sensor_msgs::CameraInfo camInfo;
+  sensor_msgs::CameraInfo camInfo; // kept from one scan to the next, only stamped when published
+  UsarsimPool<sensor_msgs::CameraInfo> camInfoPool;
   geometry_msgs::TransformStamped opticalTransform;
+  UsarsimCloud *cloud; // point cloud stage, NULL unless /usarsim/<name>/cloud is set
+  ros::Publisher stripPub; // each frame's rows as they arrive, if /usarsim/<name>/strips is set
+  ros::Publisher stripInfoPub;
+  UsarsimPool<sensor_msgs::Image> stripPool;
+  UsarsimPool<sensor_msgs::CameraInfo> stripInfoPool;
   bool isReady();
   void sentFrame(int frame);
+  void setGeometry(int width, int height, int frames);
+  void setCameraInfo(int width, int height, double fovx, double fovy);
+  bool storeFrame(int frame, int offset, int count, const float *range);
+  bool makeStrip(int offset, int count, const float *range,
+		 sensor_msgs::Image &strip, sensor_msgs::CameraInfo &stripInfo);
+  bool scanComplete();
+  bool assembling; // whether the scan in progress is being stored
   void commandCallback(const usarsim_inf::RangeImageScanConstPtr &msg);
+  void sendScan();
+  //! scan over and over, no more than rate scans a second (0 is no cap),
+  //! asking for the next lead frames before the last one; a scan that
+  //! sends no frame for timeout seconds is asked for again
+  void setContinuous(double rate, int lead, double timeout);
+  //! publish worker, for each frame: whether the next scan is to be sent now
+  bool nextScan(int frame, double now);
+  //! periodic task: whether a scan held back by the rate, or stalled, is due
+  bool pollScan(double now);
 private:
+  bool scanDue(double now); // called with stateMutex held
+  bool continuous;
+  int scanLead;
+  double scanTimeout;
+  UsarsimThrottle scanRate;
+  bool scanWanted; // the next scan is waiting for its time to be sent
+  double lastActivity; // last frame received or scan sent
+  double scanStart; // time frame 0 of the scan in progress arrived
+  unsigned long scans; // completed since statStart
+  double scanTime; // sum of their durations
+  double statStart;
   int lastFrameReceived;
+  int imageWidth;
+  int imageHeight;
+  double infoFov[2]; // field of view camInfo was worked out for
   bool ready;
+  bool complete; // depthImage holds a scan that has not been published yet
+  std::vector<uint8_t> scanData; // scan being assembled, swapped into depthImage
+  std::vector<bool> framesReceived; // completion bitmap for scanData
+  int framesStored;
 };
 ////////////////////////////////////////////////////////////////////////
 // Object sensor
@@ -289,6 +420,7 @@ public:
   bool isActive(){return commandActive;}
   void clearActive(){commandActive = false;}
   bool isDone();
+  void settleCommand();
 private:
   bool commandActive;
 };
@@ -312,26 +444,39 @@ class UsarsimActuator:public UsarsimSensor
 {
 public:
   UsarsimActuator (GenericInf *parentInf);
-  ~UsarsimActuator();
   std::vector<float> minValues;
   std::vector<float> maxValues; 
   std::vector<float> maxTorques; //config data needed for URDF generation
   std::vector <geometry_msgs::TransformStamped> jointTf; // transforms for links
+  std::vector <std::string> linkNames; // <name>_link0 .. <name>_link<numJoints>
+  std::string tipName;
+  std::vector <int> jointIndex; // index of each link joint in the servo joint state
   
   sensor_msgs::JointState jstate;
   GenericInf *infHandle;
-  CycleTimer cycleTimer;
-  Trajectory currentTrajectory;
   int numJoints;
+  std::vector <std::string> jointNames; // <name>_joint_1 .. <name>_joint_<numJoints>
+  double goalTolerance; // used where a goal gives no tolerance
+  double goalTimeTolerance; // used where a goal gives no goal_time_tolerance
   
-  void setUpTrajectory();
+  void ensureTrajectoryServer();
   void trajectoryCallback();
   void preemptCallback();
   bool isTrajectoryActive();
   bool preempted();
   void setTrajectoryResult(control_msgs::FollowJointTrajectoryResult result);
+  //! trajectory task: the command for ulapi_monotime now, false if none
+  //! is running
+  bool sampleTrajectory(double now, sw_struct *sw);
+  //! publish thread: compare a status with the plan and finish the goal
+  void updateTrajectoryStatus(const sw_struct *sw);
 private:
-  actionlib::SimpleActionServer<control_msgs::FollowJointTrajectoryAction> *trajectoryServer;
+  //! guarded by stateMutex
+  UsarsimTrajectory trajectory;
+  //! Created on first use by ensureTrajectoryServer. The callbacks are bound
+  //! to this, so the actuator must not move once the server exists; copies
+  //! share it, and the last one to go deletes it.
+  boost::shared_ptr<actionlib::SimpleActionServer<control_msgs::FollowJointTrajectoryAction> > trajectoryServer;
 };
 
 ////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,138 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimNodelet.cpp
+  \brief  The USARSim interface as a nodelet.
+
+  Runs the same interfaces as usarsim_node inside a nodelet manager.
+  Scans and depth images are published by shared pointer, so nodelets in
+  the same manager (hector_mapping, depth_image_proc, ...) get them
+  without serialization or copies. Callbacks are served by the manager's
+  worker threads instead of a spinner of our own.
+*/
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include "ros/ros.h"
+#include "ulapi.hh"
+#include "servoInf.hh"
+#include "usarsimInf.hh"
+
+namespace usarsim_inf
+{
+  class UsarsimNodelet:public nodelet::Nodelet
+  {
+  public:
+    UsarsimNodelet ()
+    {
+      servo = NULL;
+      usarsim = NULL;
+      socketTask = NULL;
+      started = false;
+    }
+    ~UsarsimNodelet ()
+    {
+      if (!started)
+	{
+	  delete servo;
+	  delete usarsim;
+	  return;
+	}
+      // the socket task may be blocked reading, or be handing a message
+      // to the pipeline; wake it and wait for it before stopping the rest
+      usarsim->stopSocket ();
+      if (socketTask != NULL)
+	{
+	  ulapi_task_join (socketTask);
+	  ulapi_task_delete (socketTask);
+	}
+      servo->stopScans ();
+      servo->stopTrajectories ();
+      usarsim->stopDrive ();
+      usarsim->stopPipeline ();
+      servo->stopClouds ();
+      // the manager's queue goes away with the nodelet, so nothing they
+      // subscribed or advertised may be left on it
+      servo->getNH ()->shutdown ();
+      usarsim->getNH ()->shutdown ();
+      delete servo;
+      delete usarsim;
+    }
+  private:
+    virtual void onInit ();
+    static void socketThread (void *arg);
+    ServoInf *servo;		// servo level interface
+    UsarsimInf *usarsim;	// usarsim interface
+    void *socketTask;
+    bool started;		// onInit started the tasks
+  };
+
+  /*
+    Reads the socket until the nodelet is unloaded or the connection
+    fails, as main does in usarsim_node. It is handed the interface
+    rather than the nodelet, and the interface keeps the stop flag.
+  */
+  void
+  UsarsimNodelet::socketThread (void *arg)
+  {
+    UsarsimInf *usarsim = reinterpret_cast < UsarsimInf * >(arg);
+
+    while ((usarsim->getNH ())->ok ())
+      {
+	if (usarsim->msgIn () != 1)
+	  {
+	    if (!usarsim->socketStopped ())
+	      ROS_ERROR ("Error from usarsimInf, socket thread exiting");
+	    break;
+	  }
+      }
+  }
+
+  void
+  UsarsimNodelet::onInit ()
+  {
+    servo = new ServoInf ();
+    usarsim = new UsarsimInf ();
+
+    if (ULAPI_OK != ulapi_init (UL_USE_DEFAULT))
+      {
+	NODELET_FATAL ("can't initialize ulapi");
+	return;
+      }
+
+    // topics go where usarsim_node puts them; callbacks go on the
+    // manager's multi-threaded queue
+    servo->setNH (getMTNodeHandle ());
+    usarsim->setNH (getMTNodeHandle ());
+    servo->init (usarsim);
+    usarsim->init (servo);
+
+    if (usarsim->startPipeline () != 1)
+      NODELET_WARN ("unable to start the publish thread, publishing from the socket thread");
+    if (usarsim->startDrive () != 1)
+      NODELET_WARN ("unable to start the drive task, sending cmd_vel as it arrives");
+    if (servo->startTrajectories () != 1)
+      NODELET_WARN ("unable to start the trajectory task, arm goals will not be followed");
+    servo->subscribeCommands ();
+    started = true;
+
+    socketTask = ulapi_task_new ();
+    if (ULAPI_OK != ulapi_task_start (socketTask, socketThread,
+				      (void *) usarsim, ulapi_prio_lowest (),
+				      1))
+      {
+	NODELET_FATAL ("unable to start the socket thread");
+	ulapi_task_delete (socketTask);
+	socketTask = NULL;
+      }
+  }
+}
+
+PLUGINLIB_EXPORT_CLASS (usarsim_inf::UsarsimNodelet, nodelet::Nodelet)
@@ -0,0 +1,527 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimPipeline.cpp
+  \brief  Hands parsed simulator messages from the socket thread to a
+  publish thread.
+
+  Neither side takes a lock to pass a record. A side only blocks on a
+  semaphore when the ring is empty (publish thread) or full (socket
+  thread). The waiting flags tell the other side that it has to give the
+  semaphore.
+*/
+#include <string.h>
+#include <ros/ros.h>
+#include "ulapi.hh"
+#include "usarsimPipeline.hh"
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimRecord
+////////////////////////////////////////////////////////////////////////
+UsarsimRecord::UsarsimRecord ()
+{
+  sw.time = 0;
+  sw.op = SW_NONE;
+  sw.type = SW_TYPE_UNINITIALIZED;
+  memset (&sw.data, 0, sizeof (sw.data));
+  mailbox = NULL;
+  payload = NULL;
+  payloadCapacity = 0;
+}
+
+UsarsimRecord::~UsarsimRecord ()
+{
+  swPayloadRelease (&payload, &payloadCapacity, 1);
+}
+
+int
+UsarsimRecord::assign (const sw_struct * src)
+{
+  const void *srcPayload = NULL;
+  int bytes = 0;
+
+  sw = *src;
+  mailbox = NULL;
+  switch (src->type)
+    {
+    case SW_SEN_RANGESCANNER:
+      srcPayload = src->data.rangescanner.range;
+      bytes = src->data.rangescanner.number * sizeof (double);
+      break;
+    case SW_SEN_RANGEIMAGER:
+      srcPayload = src->data.rangeimager.range;
+      bytes = src->data.rangeimager.numberperframe * sizeof (float);
+      break;
+    case SW_SEN_OBJECTSENSOR:
+      srcPayload = src->data.objectsensor.objects;
+      bytes = src->data.objectsensor.number * sizeof (sw_sen_object_struct);
+      break;
+    default:
+      return 1;
+    }
+  if (srcPayload == NULL || bytes <= 0)
+    return 1;
+  if (!swPayloadReserve (&payload, &payloadCapacity, bytes, 1))
+    return 0;
+  memcpy (payload, srcPayload, bytes);
+  // point the copy at our buffer; it holds exactly what was sent
+  switch (src->type)
+    {
+    case SW_SEN_RANGESCANNER:
+      sw.data.rangescanner.range = (double *) payload;
+      sw.data.rangescanner.capacity = src->data.rangescanner.number;
+      break;
+    case SW_SEN_RANGEIMAGER:
+      sw.data.rangeimager.range = (float *) payload;
+      sw.data.rangeimager.capacity = src->data.rangeimager.numberperframe;
+      break;
+    case SW_SEN_OBJECTSENSOR:
+      sw.data.objectsensor.objects = (sw_sen_object_struct *) payload;
+      sw.data.objectsensor.capacity = src->data.objectsensor.number;
+      break;
+    default:
+      break;
+    }
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimMailbox
+////////////////////////////////////////////////////////////////////////
+// set in middle while the shared record holds a message not yet taken
+#define USARSIM_MAILBOX_FULL 4
+
+UsarsimMailbox::UsarsimMailbox (const std::string & nameIn)
+{
+  name = nameIn;
+  updates = 0;
+  dropped = 0;
+  back = 0;
+  middle = 1;
+  front = 2;
+}
+
+int
+UsarsimMailbox::put (const sw_struct * sw)
+{
+  int previous;
+
+  if (!records[back].assign (sw))
+    return -1;
+  updates++;
+  previous = __atomic_exchange_n (&middle, back | USARSIM_MAILBOX_FULL,
+				  __ATOMIC_ACQ_REL);
+  back = previous & ~USARSIM_MAILBOX_FULL;
+  if (previous & USARSIM_MAILBOX_FULL)
+    {
+      // the worker has not got to the last one yet, and is already told
+      dropped++;
+      return 0;
+    }
+  return 1;
+}
+
+UsarsimRecord *
+UsarsimMailbox::take ()
+{
+  int previous;
+
+  previous = __atomic_exchange_n (&middle, front, __ATOMIC_ACQ_REL);
+  front = previous & ~USARSIM_MAILBOX_FULL;
+  return &records[front];
+}
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimWorker
+////////////////////////////////////////////////////////////////////////
+static void
+workerTask (void *arg)
+{
+  reinterpret_cast < UsarsimWorker * >(arg)->run ();
+}
+
+UsarsimWorker::UsarsimWorker (UsarsimPipeline * ownerIn, int idIn,
+			      unsigned int size):ring (size)
+{
+  owner = ownerIn;
+  id = idIn;
+  task = NULL;
+  dataSem = ulapi_sem_new (0);
+  spaceSem = ulapi_sem_new (0);
+  consumerWaiting = 0;
+  producerWaiting = 0;
+  running = 0;
+  lastReport = 0;
+  lastTraceReport = 0;
+  pushed = 0;
+  stalls = 0;
+  stallTime = 0;
+  highWater = 0;
+  occupancySum = 0;
+  popped = 0;
+  superseded = 0;
+  sleeps = 0;
+}
+
+UsarsimWorker::~UsarsimWorker ()
+{
+  stop ();
+  ulapi_sem_delete (dataSem);
+  ulapi_sem_delete (spaceSem);
+}
+
+int
+UsarsimWorker::start ()
+{
+  if (task != NULL)
+    return 1;
+  if (dataSem == NULL || spaceSem == NULL)
+    {
+      ROS_ERROR ("usarsimPipeline: unable to create semaphores");
+      return -1;
+    }
+  __atomic_store_n (&running, 1, __ATOMIC_SEQ_CST);
+  task = ulapi_task_new ();
+  if (owner->firstCpu >= 0)
+    ulapi_task_set_cpu (task, owner->firstCpu + id);
+  ulapi_task_set_fifo (task, owner->fifo);
+  if (ULAPI_OK != ulapi_task_start (task, workerTask, (void *) this,
+				    ulapi_prio_lowest (), 0))
+    {
+      ROS_ERROR ("usarsimPipeline: unable to start publish thread %d", id);
+      ulapi_task_delete (task);
+      task = NULL;
+      return -1;
+    }
+  return 1;
+}
+
+void
+UsarsimWorker::stop ()
+{
+  if (task == NULL)
+    return;
+  __atomic_store_n (&running, 0, __ATOMIC_SEQ_CST);
+  ulapi_sem_give (dataSem);
+  ulapi_task_join (task);
+  ulapi_task_delete (task);
+  task = NULL;
+}
+
+/*
+  Give the semaphore if the other side said it was going to sleep on it.
+  The fence orders our ring update before the read of the flag; the
+  sleeper sets its flag before it rechecks the ring, so one of the two
+  always sees the other.
+*/
+void
+UsarsimWorker::wake (int *waiting, void *sem)
+{
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n (waiting, 0, __ATOMIC_SEQ_CST))
+    ulapi_sem_give (sem);
+}
+
+/*
+  Next free slot, waiting for one if this worker has fallen a whole ring
+  behind.
+*/
+UsarsimRecord *
+UsarsimWorker::reserve ()
+{
+  UsarsimRecord *rec;
+  double stallStart;
+
+  rec = ring.producerSlot ();
+  if (rec == NULL)
+    {
+      stalls++;
+      stallStart = ulapi_time ();
+      while ((rec = ring.producerSlot ()) == NULL)
+	{
+	  __atomic_store_n (&producerWaiting, 1, __ATOMIC_SEQ_CST);
+	  if ((rec = ring.producerSlot ()) != NULL)
+	    break;
+	  ulapi_sem_take (spaceSem);
+	}
+      __atomic_store_n (&producerWaiting, 0, __ATOMIC_SEQ_CST);
+      stallTime += ulapi_time () - stallStart;
+    }
+  return rec;
+}
+
+int
+UsarsimWorker::push (const sw_struct * sw)
+{
+  UsarsimRecord *rec;
+  unsigned int occupancy;
+
+  rec = reserve ();
+  if (!rec->assign (sw))
+    {
+      ROS_ERROR ("usarsimPipeline: unable to copy %s message for %s",
+		 swTypeToString (sw->type), sw->name.c_str ());
+      return -1;
+    }
+  ring.push ();
+  wake (&consumerWaiting, dataSem);
+
+  pushed++;
+  occupancy = ring.occupancy ();
+  occupancySum += occupancy;
+  if (occupancy > highWater)
+    highWater = occupancy;
+  return 1;
+}
+
+int
+UsarsimWorker::push (UsarsimMailbox * mailbox)
+{
+  UsarsimRecord *rec;
+  unsigned int occupancy;
+
+  rec = reserve ();
+  rec->mailbox = mailbox;
+  ring.push ();
+  wake (&consumerWaiting, dataSem);
+
+  pushed++;
+  occupancy = ring.occupancy ();
+  occupancySum += occupancy;
+  if (occupancy > highWater)
+    highWater = occupancy;
+  return 1;
+}
+
+void
+UsarsimWorker::run ()
+{
+  UsarsimRecord *rec;
+  sw_struct *sw;
+  int unflushed = 0;
+
+  while (1)
+    {
+      rec = ring.consumerSlot ();
+      if (rec != NULL)
+	{
+	  if (rec->mailbox != NULL)
+	    sw = &rec->mailbox->take ()->sw;
+	  else
+	    sw = &rec->sw;
+	  if (sw->trace.received > 0)
+	    {
+	      sw->trace.peer = ulapi_monotime ();
+	      owner->target->peerMsg (sw);
+	      trace.record (sw, ulapi_monotime ());
+	    }
+	  else
+	    owner->target->peerMsg (sw);
+	  ring.pop ();
+	  popped++;
+	  // a busy ring still flushes now and then
+	  if (++unflushed >= USARSIM_FLUSH_MAX)
+	    {
+	      owner->target->peerFlush ();
+	      unflushed = 0;
+	    }
+	  wake (&producerWaiting, spaceSem);
+	  if (owner->reportStats && ulapi_time () - lastReport >= 10.)
+	    {
+	      logStats ("periodic");
+	      lastReport = ulapi_time ();
+	    }
+	  if (owner->traceReport > 0
+	      && ulapi_time () - lastTraceReport >= owner->traceReport)
+	    {
+	      char who[32];
+
+	      ulapi_snprintf (who, sizeof (who), "worker %d", id);
+	      trace.report (who, "periodic");
+	      lastTraceReport = ulapi_time ();
+	    }
+	  continue;
+	}
+      // drained for now, so send what the batch produced
+      if (unflushed > 0)
+	{
+	  owner->target->peerFlush ();
+	  unflushed = 0;
+	}
+      // empty; leave only once everything pushed before stop() is out
+      if (!__atomic_load_n (&running, __ATOMIC_SEQ_CST))
+	break;
+      sleeps++;
+      __atomic_store_n (&consumerWaiting, 1, __ATOMIC_SEQ_CST);
+      if (ring.consumerSlot () != NULL
+	  || !__atomic_load_n (&running, __ATOMIC_SEQ_CST))
+	{
+	  __atomic_store_n (&consumerWaiting, 0, __ATOMIC_SEQ_CST);
+	  continue;
+	}
+      ulapi_sem_take (dataSem);
+    }
+}
+
+void
+UsarsimWorker::logStats (const char *why)
+{
+  unsigned long pushCount = __atomic_load_n (&pushed, __ATOMIC_RELAXED);
+
+  ROS_INFO ("usarsimPipeline worker %d (%s): %lu pushed, %lu published, "
+	    "occupancy %u now %.1f mean %u peak of %u, "
+	    "%lu stalls (%.3f s), %lu idle waits, %lu superseded",
+	    id, why, pushCount, popped, ring.occupancy (),
+	    pushCount ? occupancySum / pushCount : 0., highWater,
+	    ring.size (), __atomic_load_n (&stalls, __ATOMIC_RELAXED),
+	    stallTime, sleeps, __atomic_load_n (&superseded, __ATOMIC_RELAXED));
+}
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimPipeline
+////////////////////////////////////////////////////////////////////////
+UsarsimPipeline::UsarsimPipeline (GenericInf * targetIn, int workerCount,
+				  unsigned int size)
+{
+  target = targetIn;
+  reportStats = false;
+  firstCpu = -1;
+  fifo = false;
+  tracing = false;
+  traceReport = 0;
+  started = false;
+  ringSize = size;
+  nextHeavy = 0;
+  if (workerCount < 1)
+    workerCount = 1;
+  for (int count = 0; count < workerCount; count++)
+    workers.push_back (new UsarsimWorker (this, count, size));
+}
+
+UsarsimPipeline::~UsarsimPipeline ()
+{
+  stop ();
+  for (unsigned int count = 0; count < workers.size (); count++)
+    delete workers[count];
+  for (unsigned int count = 0; count < mailboxes.size (); count++)
+    delete mailboxes[count];
+}
+
+int
+UsarsimPipeline::start ()
+{
+  for (unsigned int count = 0; count < workers.size (); count++)
+    {
+      if (workers[count]->start () != 1)
+	{
+	  stop ();
+	  return -1;
+	}
+    }
+  started = true;
+  ROS_INFO ("usarsimPipeline: publishing on %d threads through %u record rings",
+	    (int) workers.size (), ringSize);
+  return 1;
+}
+
+void
+UsarsimPipeline::stop ()
+{
+  for (unsigned int count = 0; count < workers.size (); count++)
+    workers[count]->stop ();
+  if (started)
+    {
+      logStats ("shutdown");
+      if (tracing)
+	logTrace ("shutdown");
+    }
+  started = false;
+}
+
+int
+UsarsimPipeline::assignShard (int type)
+{
+  if (workers.size () < 2)
+    return 0;
+  switch (type)
+    {
+    case SW_SEN_RANGESCANNER:
+    case SW_SEN_RANGEIMAGER:
+    case SW_SEN_OBJECTSENSOR:
+      nextHeavy = nextHeavy % (workers.size () - 1) + 1;
+      return nextHeavy;
+    default:
+      return 0;
+    }
+}
+
+int
+UsarsimPipeline::addMailbox (const std::string & name)
+{
+  mailboxes.push_back (new UsarsimMailbox (name));
+  return mailboxes.size () - 1;
+}
+
+int
+UsarsimPipeline::push (const sw_struct * sw, int shard, int mailbox)
+{
+  int result;
+
+  if (shard < 0 || shard >= (int) workers.size ())
+    shard = 0;
+  if (mailbox < 0 || mailbox >= (int) mailboxes.size ())
+    return workers[shard]->push (sw);
+
+  result = mailboxes[mailbox]->put (sw);
+  if (result < 0)
+    {
+      ROS_ERROR ("usarsimPipeline: unable to copy %s message for %s",
+		 swTypeToString (sw->type), sw->name.c_str ());
+      return -1;
+    }
+  if (result == 0)
+    {
+      __atomic_fetch_add (&workers[shard]->superseded, 1, __ATOMIC_RELAXED);
+      return 1;
+    }
+  return workers[shard]->push (mailboxes[mailbox]);
+}
+
+void
+UsarsimPipeline::logStats (const char *why)
+{
+  for (unsigned int count = 0; count < workers.size (); count++)
+    workers[count]->logStats (why);
+  for (unsigned int count = 0; count < mailboxes.size (); count++)
+    if (mailboxes[count]->dropped)
+      ROS_INFO ("usarsimPipeline %s (%s): dropped %lu of %lu messages for newer ones",
+		mailboxes[count]->name.c_str (), why,
+		mailboxes[count]->dropped, mailboxes[count]->updates);
+}
+
+void
+UsarsimPipeline::logTrace (const char *why)
+{
+  char who[32];
+
+  for (unsigned int count = 0; count < workers.size (); count++)
+    {
+      ulapi_snprintf (who, sizeof (who), "worker %u", count);
+      workers[count]->trace.report (who, why);
+    }
+}
+
+void
+UsarsimPipeline::clearTrace ()
+{
+  for (unsigned int count = 0; count < workers.size (); count++)
+    workers[count]->trace.clear ();
+}
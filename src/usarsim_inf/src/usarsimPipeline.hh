@@ -0,0 +1,207 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimPipeline.hh
+  \brief  Hands parsed simulator messages from the socket thread to a
+  publish thread.
+
+  The socket thread parses each message into an sw_struct and pushes a
+  copy of it (payload included) into the ring of the worker that owns the
+  component. Each worker drains its ring into the servo interface, which
+  does the TF math, message building and ROS publishing. A slow publish
+  therefore no longer holds up socket reads unless a ring fills up.
+  A worker that runs dry, or has handled USARSIM_FLUSH_MAX messages,
+  calls peerFlush so that the servo interface sends the transforms and
+  joint state of the whole batch at once.
+
+  Components whose status is only interesting while it is current go
+  through a mailbox instead of the ring. Each new status overwrites the
+  one still waiting in the mailbox, so a worker that falls behind
+  publishes the newest data rather than working through a backlog.
+*/
+#ifndef __usarsimPipeline__
+#define __usarsimPipeline__
+#include <vector>
+#include <string>
+#include "simware.hh"
+#include "genericInf.hh"
+#include "usarsimRing.hh"
+#include "usarsimTrace.hh"
+
+//! most messages a worker handles between flushes of its output
+#define USARSIM_FLUSH_MAX 32
+
+//! how a component's status messages reach its worker
+enum usarsimQueuePolicy
+{
+  USARSIM_QUEUE_ALL = 0,	//!< every message, in order; may stall the socket thread
+  USARSIM_QUEUE_LATEST		//!< newest message only, older ones are dropped
+};
+
+class UsarsimMailbox;
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimRecord
+////////////////////////////////////////////////////////////////////////
+/*!
+  One ring slot. The sw_struct's payload pointer (range or object array)
+  is redirected to a buffer owned by the slot, which only grows.
+*/
+class UsarsimRecord
+{
+public:
+  UsarsimRecord ();
+  ~UsarsimRecord ();
+  //! deep copy of src; returns 0 if the payload could not be copied
+  int assign (const sw_struct * src);
+  sw_struct sw;
+  //! if set, the record is only a note to publish this mailbox's newest
+  UsarsimMailbox *mailbox;
+private:
+  UsarsimRecord (const UsarsimRecord &);
+  UsarsimRecord & operator= (const UsarsimRecord &);
+  void *payload;
+  int payloadCapacity;		// bytes
+};
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimMailbox
+////////////////////////////////////////////////////////////////////////
+/*!
+  Newest status of one component, handed from the socket thread to a
+  worker through three records: the socket thread fills its own record
+  and swaps it with the shared one, and the worker swaps the shared one
+  for its own when it gets to it. Neither side waits on the other.
+*/
+class UsarsimMailbox
+{
+public:
+  UsarsimMailbox (const std::string & nameIn);
+  //! socket thread; returns -1 if the message could not be copied, 1 if
+  //! the worker has to be told about it and 0 if it already was
+  int put (const sw_struct * sw);
+  //! worker; the newest record, valid until the next take
+  UsarsimRecord *take ();
+  std::string name;
+  unsigned long updates;	//!< messages put
+  unsigned long dropped;	//!< messages overwritten before they were published
+private:
+  UsarsimMailbox (const UsarsimMailbox &);
+  UsarsimMailbox & operator= (const UsarsimMailbox &);
+  UsarsimRecord records[3];
+  int back;			// socket thread's record
+  int middle;			// shared record, plus USARSIM_MAILBOX_FULL
+  int front;			// worker's record
+};
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimPipeline
+////////////////////////////////////////////////////////////////////////
+class UsarsimPipeline;
+
+/*!
+  One publish thread and the ring that feeds it. The socket thread is the
+  only producer for every worker.
+*/
+class UsarsimWorker
+{
+public:
+  UsarsimWorker (UsarsimPipeline * ownerIn, int idIn, unsigned int size);
+  ~UsarsimWorker ();
+  int start ();
+  void stop ();
+  int push (const sw_struct * sw);
+  //! queue a note that the mailbox has something new
+  int push (UsarsimMailbox * mailbox);
+  //! body of the publish thread
+  void run ();
+  void logStats (const char *why);
+  //! latency of the components this worker publishes; only it records
+  UsarsimTraceTable trace;
+
+  //! statistics; producer counters are only written by the socket thread
+  unsigned long pushed;		//!< records handed to the ring
+  unsigned long stalls;		//!< pushes that found the ring full
+  double stallTime;		//!< seconds the socket thread spent waiting
+  unsigned int highWater;	//!< largest occupancy seen by a push
+  double occupancySum;		//!< sum of occupancies seen by pushes
+  unsigned long popped;		//!< records published
+  unsigned long superseded;	//!< mailbox messages dropped for newer ones
+  unsigned long sleeps;		//!< times the publish thread ran dry
+private:
+  UsarsimWorker (const UsarsimWorker &);
+  UsarsimWorker & operator= (const UsarsimWorker &);
+  void wake (int *waiting, void *sem);
+  UsarsimRecord *reserve ();
+  UsarsimPipeline *owner;
+  int id;
+  UsarsimRing < UsarsimRecord > ring;
+  void *task;
+  void *dataSem;		// given when a record arrives for a sleeping consumer
+  void *spaceSem;		// given when a slot frees up for a stalled producer
+  int consumerWaiting;
+  int producerWaiting;
+  int running;
+  double lastReport;		// ulapi_time of the last periodic log
+  double lastTraceReport;	// ulapi_time of the last latency report
+};
+
+/*!
+  Spreads the sibling's message handling over a few workers. Every
+  component is pinned to one worker, so its messages stay in order.
+  Worker 0 takes the robot, its actuators, effectors and the small
+  sensors; the bulky sensors (range scanners, range imagers and object
+  sensors) are dealt round robin to the other workers, so a burst from
+  one of them never queues in front of odometry.
+*/
+class UsarsimPipeline
+{
+public:
+  UsarsimPipeline (GenericInf * targetIn, int workers, unsigned int size);
+  ~UsarsimPipeline ();
+  //! start the publish threads
+  int start ();
+  //! drain what is queued, stop the publish threads and log the statistics
+  void stop ();
+  //! worker for a component that has not been assigned one yet
+  int assignShard (int type);
+  //! mailbox for a component on the given worker; returns its number
+  int addMailbox (const std::string & name);
+  //! called by the socket thread; blocks only while the worker's ring is
+  //! full. With a mailbox number the message only replaces the one in
+  //! that mailbox.
+  int push (const sw_struct * sw, int shard, int mailbox = -1);
+  void logStats (const char *why);
+  //! log the workers' latency histograms
+  void logTrace (const char *why);
+  //! have the workers start their latency histograms over
+  void clearTrace ();
+  int getWorkers ()
+  {
+    return workers.size ();
+  }
+  GenericInf *target;
+  bool reportStats;		//!< log statistics periodically
+  int firstCpu;			//!< worker n is pinned to firstCpu + n; -1 for none
+  bool fifo;			//!< run the workers under SCHED_FIFO
+  bool tracing;			//!< messages carry trace times
+  double traceReport;		//!< seconds between latency reports, 0 for none
+private:
+  UsarsimPipeline (const UsarsimPipeline &);
+  UsarsimPipeline & operator= (const UsarsimPipeline &);
+  std::vector < UsarsimWorker * >workers;
+  std::vector < UsarsimMailbox * >mailboxes;
+  int nextHeavy;		// round robin over workers 1..n-1
+  unsigned int ringSize;
+  bool started;
+};
+
+#endif
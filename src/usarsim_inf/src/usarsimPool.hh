@@ -0,0 +1,49 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimPool.hh
+  \brief  Reusable messages for publishing by shared pointer.
+
+  A message published as a shared pointer goes to subscribers in the
+  same process without being serialized or copied; they keep a reference
+  for as long as they need it. The pool hands a message out again once
+  every such reference is gone, so its arrays keep their capacity from
+  one publish to the next. One thread may take from a pool.
+*/
+#ifndef __usarsimPool__
+#define __usarsimPool__
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#define USARSIM_POOL_MAX 4	/*!< messages kept by a pool */
+
+template < class M > class UsarsimPool
+{
+public:
+  //! a message nobody else holds, with whatever it held last time
+  boost::shared_ptr < M > take ()
+  {
+    for (unsigned int i = 0; i < msgs.size (); i++)
+      if (msgs[i].unique ())
+	return msgs[i];
+    if (msgs.size () < USARSIM_POOL_MAX)
+      {
+	msgs.push_back (boost::shared_ptr < M > (new M));
+	return msgs.back ();
+      }
+    // subscribers are holding on to all of them; this one is not kept
+    return boost::shared_ptr < M > (new M);
+  }
+private:
+  std::vector < boost::shared_ptr < M > > msgs;
+};
+
+#endif
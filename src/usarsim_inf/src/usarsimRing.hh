@@ -0,0 +1,107 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimRing.hh
+  \brief  Lock-free single producer, single consumer ring of records.
+
+  The slots are allocated once and then reused in place; the producer
+  fills the slot returned by producerSlot() and hands it over with push(),
+  and the consumer reads consumerSlot() and gives it back with pop().
+  Exactly one thread may produce and exactly one thread may consume.
+*/
+#ifndef __usarsimRing__
+#define __usarsimRing__
+
+#define USARSIM_CACHE_LINE 64
+
+template < class T > class UsarsimRing
+{
+public:
+  //! size is rounded up to a power of two
+  UsarsimRing (unsigned int sizeIn)
+  {
+    ringSize = 1;
+    while (ringSize < sizeIn)
+      ringSize <<= 1;
+    mask = ringSize - 1;
+    slots = new T[ringSize];
+    head = 0;
+    tail = 0;
+    producerHead = 0;
+    consumerTail = 0;
+  }
+  ~UsarsimRing ()
+  {
+    delete[]slots;
+  }
+  //! slot to fill next, or NULL if the ring is full
+  T *producerSlot ()
+  {
+    if (tail - producerHead == ringSize)
+      {
+	// only reread the consumer's index when the cached one says full
+	producerHead = __atomic_load_n (&head, __ATOMIC_ACQUIRE);
+	if (tail - producerHead == ringSize)
+	  return NULL;
+      }
+    return &slots[tail & mask];
+  }
+  //! hand the slot returned by producerSlot to the consumer
+  void push ()
+  {
+    __atomic_store_n (&tail, tail + 1, __ATOMIC_RELEASE);
+  }
+  //! oldest filled slot, or NULL if the ring is empty
+  T *consumerSlot ()
+  {
+    if (consumerTail == head)
+      {
+	consumerTail = __atomic_load_n (&tail, __ATOMIC_ACQUIRE);
+	if (consumerTail == head)
+	  return NULL;
+      }
+    return &slots[head & mask];
+  }
+  //! give the slot returned by consumerSlot back to the producer
+  void pop ()
+  {
+    __atomic_store_n (&head, head + 1, __ATOMIC_RELEASE);
+  }
+  //! number of filled slots; exact only when called by one of the two ends
+  unsigned int occupancy () const
+  {
+    return __atomic_load_n (&tail, __ATOMIC_ACQUIRE) -
+      __atomic_load_n (&head, __ATOMIC_ACQUIRE);
+  }
+  unsigned int size () const
+  {
+    return ringSize;
+  }
+
+private:
+  UsarsimRing (const UsarsimRing &);
+  UsarsimRing & operator= (const UsarsimRing &);
+
+  T *slots;
+  unsigned int ringSize;
+  unsigned int mask;
+  // the two indices are on their own cache lines so that the producer and
+  // consumer do not invalidate each other on every record
+  char pad0[USARSIM_CACHE_LINE];
+  unsigned int head;		// next slot to consume, written by the consumer
+  unsigned int consumerTail;	// consumer's copy of tail
+  char pad1[USARSIM_CACHE_LINE];
+  unsigned int tail;		// next slot to fill, written by the producer
+  unsigned int producerHead;	// producer's copy of head
+  char pad2[USARSIM_CACHE_LINE];
+};
+
+#endif
@@ -0,0 +1,127 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimState.hh
+  \brief  Newest robot state, readable from any thread without a lock.
+
+  The socket thread folds every parsed message into its own copy of the
+  robot state and publishes that copy once per socket read. Callbacks,
+  tasks and tools take a consistent copy of the newest state whenever
+  they need it, instead of reading fields that other threads are
+  changing.
+*/
+#ifndef __usarsimState__
+#define __usarsimState__
+#include <string.h>
+#include "simware.hh"
+
+#define USARSIM_STATE_ACTUATOR_MAX 16	/*!< actuators kept in the state */
+#define USARSIM_STATE_EFFECTOR_MAX 16	/*!< grippers and toolchangers kept */
+
+typedef struct
+{
+  char name[SW_NAME_MAX];
+  double time;
+  int number;
+  double position[SW_ACT_LINK_MAX];
+} UsarsimActuatorState;
+
+typedef struct
+{
+  char name[SW_NAME_MAX];
+  double time;
+  int type;			/*!< SW_EFF_GRIPPER or SW_EFF_TOOLCHANGER */
+  toolchanger_tool_type tooltype;
+  effector_status status;
+} UsarsimEffectorState;
+
+/*!
+  Plain data only, so that it can be copied with memcpy. Names are
+  truncated to SW_NAME_MAX - 1 characters.
+*/
+typedef struct
+{
+  double time;			/*!< simulator time of the newest message */
+  unsigned long messages;	/*!< messages folded in so far */
+  char platformName[SW_NAME_MAX];
+  double length;
+  double width;
+  double height;
+  sw_steer_type steerType;
+  double speed;
+  double heading;
+  char poseSource[SW_NAME_MAX];	/*!< INS or odometer the pose came from */
+  double poseTime;
+  sw_pose pose;
+  int actuators;
+  UsarsimActuatorState actuator[USARSIM_STATE_ACTUATOR_MAX];
+  int effectors;
+  UsarsimEffectorState effector[USARSIM_STATE_EFFECTOR_MAX];
+} RobotStateSnapshot;
+
+/*!
+  Single writer, any number of readers, nobody waits. The writer fills
+  whichever of two buffers is not the newest and then makes it the
+  newest, so a reader copying the newest buffer is only disturbed if the
+  writer publishes twice during the copy. A version per buffer, odd while
+  it is being written, tells the reader when that happened.
+*/
+template < class T > class UsarsimSeqlock
+{
+public:
+  UsarsimSeqlock ()
+  {
+    sequence = 0;
+    version[0] = 0;
+    version[1] = 0;
+    memset (buffer, 0, sizeof (buffer));
+  }
+  //! writer only; value becomes the newest
+  void write (const T & value)
+  {
+    unsigned int next = (sequence + 1) & 1;
+    unsigned int v = version[next];
+
+    __atomic_store_n (&version[next], v + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy (&buffer[next], &value, sizeof (T));
+    __atomic_store_n (&version[next], v + 2, __ATOMIC_RELEASE);
+    __atomic_store_n (&sequence, sequence + 1, __ATOMIC_RELEASE);
+  }
+  //! copy of the newest value; returns how many writes it reflects, 0
+  //! if there have been none
+  unsigned long read (T & value) const
+  {
+    unsigned long seq;
+    unsigned int b, v;
+
+    for (;;)
+      {
+	seq = __atomic_load_n (&sequence, __ATOMIC_ACQUIRE);
+	b = seq & 1;
+	v = __atomic_load_n (&version[b], __ATOMIC_ACQUIRE);
+	if (v & 1)
+	  continue;
+	memcpy (&value, &buffer[b], sizeof (T));
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	if (__atomic_load_n (&version[b], __ATOMIC_RELAXED) == v)
+	  return seq;
+      }
+  }
+private:
+  UsarsimSeqlock (const UsarsimSeqlock &);
+  UsarsimSeqlock & operator= (const UsarsimSeqlock &);
+  unsigned long sequence;	// writes so far; buffer[sequence & 1] is newest
+  unsigned int version[2];
+  T buffer[2];
+};
+
+#endif
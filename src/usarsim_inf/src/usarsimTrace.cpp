@@ -0,0 +1,221 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimTrace.cpp
+  \brief  Latency of each stage a simulator message goes through.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <ros/ros.h>
+#include "usarsimTrace.hh"
+
+#define SUB_COUNT (1u << USARSIM_TRACE_SUB_BITS)
+#define MAX_USEC ((uint64_t) 1 << (USARSIM_TRACE_MAGNITUDES + USARSIM_TRACE_SUB_BITS))
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimHistogram
+////////////////////////////////////////////////////////////////////////
+UsarsimHistogram::UsarsimHistogram ()
+{
+  clear ();
+}
+
+void
+UsarsimHistogram::clear ()
+{
+  memset (counts, 0, sizeof (counts));
+  total = 0;
+  max = 0;
+}
+
+/*
+  Values below SUB_COUNT get a bucket each. Above that, the bucket is the
+  value's power of two and the SUB_BITS bits below its top bit.
+*/
+unsigned int
+UsarsimHistogram::bucket (uint64_t usec)
+{
+  if (usec < SUB_COUNT)
+    return usec;
+  if (usec >= MAX_USEC)
+    usec = MAX_USEC - 1;
+  unsigned int top = 63 - __builtin_clzll (usec);
+  unsigned int shift = top - USARSIM_TRACE_SUB_BITS;
+
+  return ((shift + 1) << USARSIM_TRACE_SUB_BITS)
+    + (unsigned int) ((usec >> shift) & (SUB_COUNT - 1));
+}
+
+//! largest value, in seconds, that falls in bucket index
+double
+UsarsimHistogram::bucketTop (unsigned int index)
+{
+  if (index < SUB_COUNT)
+    return index * 1.0e-6;
+  unsigned int shift = (index >> USARSIM_TRACE_SUB_BITS) - 1;
+  uint64_t low = (uint64_t) (SUB_COUNT + (index & (SUB_COUNT - 1))) << shift;
+
+  return (low + ((uint64_t) 1 << shift) - 1) * 1.0e-6;
+}
+
+/*
+  Only the owner writes, so plain increments would do; the atomic stores
+  just keep a reader from seeing a torn value.
+*/
+void
+UsarsimHistogram::record (double seconds)
+{
+  uint64_t usec = seconds > 0 ? (uint64_t) (seconds * 1.0e6) : 0;
+  unsigned int index = bucket (usec);
+
+  __atomic_store_n (&counts[index], counts[index] + 1, __ATOMIC_RELAXED);
+  __atomic_store_n (&total, total + 1, __ATOMIC_RELAXED);
+  if (usec > max)
+    __atomic_store_n (&max, usec, __ATOMIC_RELAXED);
+}
+
+unsigned long
+UsarsimHistogram::getCount () const
+{
+  return __atomic_load_n (&total, __ATOMIC_RELAXED);
+}
+
+double
+UsarsimHistogram::getMax () const
+{
+  return __atomic_load_n (&max, __ATOMIC_RELAXED) * 1.0e-6;
+}
+
+double
+UsarsimHistogram::percentile (double q) const
+{
+  unsigned long n = getCount ();
+  unsigned long seen = 0;
+
+  if (n == 0)
+    return 0;
+  // the sample q of the way up, counting from 1
+  unsigned long want = (unsigned long) ceil (q * n);
+  double max = getMax ();
+
+  if (want < 1)
+    want = 1;
+  for (unsigned int i = 0; i < USARSIM_TRACE_BUCKETS; i++)
+    {
+      seen += __atomic_load_n (&counts[i], __ATOMIC_RELAXED);
+      if (seen >= want)
+	return bucketTop (i) < max ? bucketTop (i) : max;
+    }
+  return max;
+}
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimTraceTable
+////////////////////////////////////////////////////////////////////////
+UsarsimTraceTable::UsarsimTraceTable ()
+{
+  memset (entries, 0, sizeof (entries));
+  count = 0;
+  last = 0;
+  clearWanted = 0;
+}
+
+UsarsimTraceTable::~UsarsimTraceTable ()
+{
+  for (int i = 0; i < count; i++)
+    delete entries[i];
+}
+
+UsarsimTraceTable::Entry *
+UsarsimTraceTable::find (const std::string & name)
+{
+  // a burst is usually from one component
+  if (last < count && entries[last]->name == name)
+    return entries[last];
+  for (int i = 0; i < count; i++)
+    if (entries[i]->name == name)
+      {
+	last = i;
+	return entries[i];
+      }
+  if (count >= USARSIM_TRACE_COMPONENTS)
+    {
+      ROS_WARN_ONCE ("usarsimTrace: more than %d components, %s is not traced",
+		     USARSIM_TRACE_COMPONENTS, name.c_str ());
+      return NULL;
+    }
+  entries[count] = new Entry;
+  entries[count]->name = name;
+  last = count;
+  __atomic_store_n (&count, count + 1, __ATOMIC_RELEASE);
+  return entries[last];
+}
+
+void
+UsarsimTraceTable::record (const sw_struct * sw, double published)
+{
+  const sw_trace & t = sw->trace;
+  Entry *entry;
+
+  if (t.received <= 0)
+    return;
+  if (__atomic_exchange_n (&clearWanted, 0, __ATOMIC_ACQUIRE))
+    for (int i = 0; i < count; i++)
+      for (int s = 0; s < USARSIM_STAGES; s++)
+	entries[i]->stages[s].clear ();
+  if ((entry = find (sw->name)) == NULL)
+    return;
+  entry->stages[USARSIM_STAGE_FRAME].record (t.framed - t.received);
+  entry->stages[USARSIM_STAGE_PARSE].record (t.parsed - t.framed);
+  entry->stages[USARSIM_STAGE_QUEUE].record (t.peer - t.parsed);
+  entry->stages[USARSIM_STAGE_PUBLISH].record (published - t.peer);
+  entry->stages[USARSIM_STAGE_TOTAL].record (published - t.received);
+}
+
+void
+UsarsimTraceTable::clear ()
+{
+  __atomic_store_n (&clearWanted, 1, __ATOMIC_RELEASE);
+}
+
+/*
+  One line per component; each stage is its p50/p99/p999 in milliseconds.
+*/
+void
+UsarsimTraceTable::report (const char *who, const char *why) const
+{
+  static const char *stageNames[USARSIM_STAGES] =
+    { "frame", "parse", "queue", "publish", "total" };
+  int n = __atomic_load_n (&count, __ATOMIC_ACQUIRE);
+
+  for (int i = 0; i < n; i++)
+    {
+      const Entry *entry = entries[i];
+      char line[512];
+      int len;
+
+      len = snprintf (line, sizeof (line), "%lu messages",
+		      entry->stages[USARSIM_STAGE_TOTAL].getCount ());
+      for (int s = 0; s < USARSIM_STAGES && len < (int) sizeof (line); s++)
+	{
+	  const UsarsimHistogram & h = entry->stages[s];
+
+	  len += snprintf (line + len, sizeof (line) - len,
+			   ", %s %.3f/%.3f/%.3f", stageNames[s],
+			   h.percentile (0.5) * 1.0e3,
+			   h.percentile (0.99) * 1.0e3,
+			   h.percentile (0.999) * 1.0e3);
+	}
+      ROS_INFO ("usarsimTrace %s %s (%s): %s ms (p50/p99/p999)", who,
+		entry->name.c_str (), why, line);
+    }
+}
@@ -0,0 +1,101 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimTrace.hh
+  \brief  Latency of each stage a simulator message goes through.
+
+  Every traced message carries the times it was received, framed, parsed
+  and handed to the servo interface (sw_trace). Whoever calls peerMsg
+  then records those stages, and the publish time, in the histograms of
+  the message's component. Each publish thread owns its own table, and
+  a component only ever goes through one thread, so recording needs no
+  locks; any thread may read a table for a report.
+
+  Histograms are log-linear, as HDR histograms are: 16 buckets for every
+  power of two microseconds, which keeps percentiles within about 6% from
+  a microsecond up to hours.
+*/
+#ifndef __usarsimTrace__
+#define __usarsimTrace__
+#include <stdint.h>
+#include <string>
+#include "simware.hh"
+
+#define USARSIM_TRACE_SUB_BITS 4	/*!< log2 of the buckets per power of two */
+#define USARSIM_TRACE_MAGNITUDES 32	/*!< powers of two covered, in microseconds */
+#define USARSIM_TRACE_BUCKETS ((USARSIM_TRACE_MAGNITUDES + 1) << USARSIM_TRACE_SUB_BITS)
+#define USARSIM_TRACE_COMPONENTS 64	/*!< components a table keeps */
+
+//! the intervals measured for every message
+enum usarsimTraceStage
+{
+  USARSIM_STAGE_FRAME = 0,	//!< first bytes read to line complete
+  USARSIM_STAGE_PARSE,		//!< line complete to parsed
+  USARSIM_STAGE_QUEUE,		//!< parsed to taken by a publish thread
+  USARSIM_STAGE_PUBLISH,	//!< peerMsg, building and publishing
+  USARSIM_STAGE_TOTAL,		//!< first bytes read to published
+  USARSIM_STAGES
+};
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimHistogram
+////////////////////////////////////////////////////////////////////////
+//! written by one thread, read by any
+class UsarsimHistogram
+{
+public:
+  UsarsimHistogram ();
+  void record (double seconds);
+  void clear ();
+  unsigned long getCount () const;
+  //! seconds below which fraction q of the samples fall
+  double percentile (double q) const;
+  double getMax () const;
+private:
+  static unsigned int bucket (uint64_t usec);
+  static double bucketTop (unsigned int index);
+  uint32_t counts[USARSIM_TRACE_BUCKETS];
+  unsigned long total;
+  uint64_t max;			// microseconds
+};
+
+////////////////////////////////////////////////////////////////////////
+// UsarsimTraceTable
+////////////////////////////////////////////////////////////////////////
+class UsarsimTraceTable
+{
+public:
+  UsarsimTraceTable ();
+  ~UsarsimTraceTable ();
+  //! owner only; sw has gone through peerMsg, which returned at published
+  void record (const sw_struct * sw, double published);
+  //! any thread; log p50/p99/p999 of every stage of every component
+  void report (const char *who, const char *why) const;
+  //! any thread; the owner starts the histograms over at its next record
+  void clear ();
+private:
+  UsarsimTraceTable (const UsarsimTraceTable &);
+  UsarsimTraceTable & operator= (const UsarsimTraceTable &);
+  class Entry
+  {
+  public:
+    std::string name;
+    UsarsimHistogram stages[USARSIM_STAGES];
+  };
+  Entry *find (const std::string & name);
+  // only appended to; count is published after the entry is filled in
+  Entry *entries[USARSIM_TRACE_COMPONENTS];
+  int count;
+  int last;			// entry of the previous record
+  int clearWanted;
+};
+
+#endif
@@ -0,0 +1,269 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimTrajectory.cpp
+  \brief  Joint trajectories as splines that can be sampled at any time.
+*/
+#include <math.h>
+#include <string.h>
+#include "simware.hh"
+#include "usarsimTrajectory.hh"
+
+UsarsimTrajectory::UsarsimTrajectory ()
+{
+  active = false;
+  startTime = 0;
+  duration = 0;
+  goalTime = 0;
+  trackSamples = 0;
+  trackMax = 0;
+  trackSumSq = 0;
+}
+
+bool
+UsarsimTrajectory::build (const control_msgs::FollowJointTrajectoryGoal & goal,
+			  const std::vector < std::string > &jointNames,
+			  const std::vector < double >&start,
+			  double defaultTolerance, double defaultGoalTime,
+			  std::string & error)
+{
+  const trajectory_msgs::JointTrajectory & traj = goal.trajectory;
+  unsigned int numLinks = start.size ();
+  unsigned int numJoints = traj.joint_names.size ();
+  unsigned int numPoints = traj.points.size ();
+  std::vector < int >linkOf (numJoints, -1);
+  bool byName = false;
+  bool hasVel = true;
+  bool hasAcc = true;
+
+  active = false;
+  if (numPoints == 0 || numJoints == 0)
+    {
+      error = "empty trajectory";
+      return false;
+    }
+  if (numJoints > numLinks || numLinks > SW_ACT_LINK_MAX)
+    {
+      error = "more joints than the actuator has links";
+      return false;
+    }
+
+  // match goal joints to links by name; a goal that uses none of our
+  // names is taken in link order
+  for (unsigned int j = 0; j < numJoints; j++)
+    for (unsigned int i = 0; i < jointNames.size () && i < numLinks; i++)
+      if (traj.joint_names[j] == jointNames[i])
+	{
+	  linkOf[j] = i;
+	  byName = true;
+	}
+  for (unsigned int j = 0; j < numJoints; j++)
+    {
+      if (!byName)
+	linkOf[j] = j;
+      else if (linkOf[j] < 0)
+	{
+	  error = "unknown joint " + traj.joint_names[j];
+	  return false;
+	}
+    }
+
+  for (unsigned int k = 0; k < numPoints; k++)
+    {
+      const trajectory_msgs::JointTrajectoryPoint & point = traj.points[k];
+      if (point.positions.size () != numJoints)
+	{
+	  error = "point without a position for every joint";
+	  return false;
+	}
+      if (k > 0 && point.time_from_start < traj.points[k - 1].time_from_start)
+	{
+	  error = "points out of time order";
+	  return false;
+	}
+      if (point.velocities.size () != numJoints)
+	hasVel = false;
+      if (point.accelerations.size () != numJoints)
+	hasAcc = false;
+    }
+  hasAcc = hasAcc && hasVel;
+
+  links.assign (numLinks, std::vector < Segment > ());
+  goalPositions = start;
+  tolerances.assign (numLinks, defaultTolerance);
+  duration = traj.points[numPoints - 1].time_from_start.toSec ();
+  goalTime = goal.goal_time_tolerance.toSec () > 0 ?
+    goal.goal_time_tolerance.toSec () : defaultGoalTime;
+
+  for (unsigned int i = 0; i < numLinks; i++)
+    {
+      Segment hold;
+
+      // links the goal leaves alone stay where they are
+      memset (&hold, 0, sizeof (hold));
+      hold.c[0] = start[i];
+      links[i].push_back (hold);
+    }
+
+  for (unsigned int j = 0; j < numJoints; j++)
+    {
+      std::vector < Segment > &segments = links[linkOf[j]];
+      double x0 = start[linkOf[j]];
+      double v0 = 0, a0 = 0;	// the arm starts at rest
+      double t0 = 0;
+
+      segments.clear ();
+      for (unsigned int k = 0; k < numPoints; k++)
+	{
+	  const trajectory_msgs::JointTrajectoryPoint & point = traj.points[k];
+	  double t1 = point.time_from_start.toSec ();
+	  double x1 = point.positions[j];
+	  double v1 = 0, a1 = 0;
+	  double T = t1 - t0;
+	  double h = x1 - x0;
+	  Segment seg;
+
+	  if (hasVel)
+	    v1 = point.velocities[j];
+	  else if (k + 1 < numPoints)
+	    {
+	      // average of the slopes on either side, or stop at a turn
+	      double t2 = traj.points[k + 1].time_from_start.toSec ();
+	      double x2 = traj.points[k + 1].positions[j];
+	      if (T > 0 && t2 > t1)
+		{
+		  double s0 = h / T;
+		  double s1 = (x2 - x1) / (t2 - t1);
+		  if (s0 * s1 > 0)
+		    v1 = (s0 + s1) / 2.;
+		}
+	    }
+	  if (hasAcc)
+	    a1 = point.accelerations[j];
+
+	  memset (&seg, 0, sizeof (seg));
+	  seg.start = t0;
+	  if (T <= 0)
+	    {
+	      // two points at the same time; jump to the later one
+	      seg.c[0] = x1;
+	    }
+	  else if (hasAcc)
+	    {
+	      double T2 = T * T, T3 = T2 * T;
+	      seg.length = T;
+	      seg.c[0] = x0;
+	      seg.c[1] = v0;
+	      seg.c[2] = a0 / 2.;
+	      seg.c[3] = (20. * h - (8. * v1 + 12. * v0) * T
+			  - (3. * a0 - a1) * T2) / (2. * T3);
+	      seg.c[4] = (-30. * h + (14. * v1 + 16. * v0) * T
+			  + (3. * a0 - 2. * a1) * T2) / (2. * T3 * T);
+	      seg.c[5] = (12. * h - 6. * (v1 + v0) * T
+			  + (a1 - a0) * T2) / (2. * T3 * T2);
+	    }
+	  else
+	    {
+	      seg.length = T;
+	      seg.c[0] = x0;
+	      seg.c[1] = v0;
+	      seg.c[2] = (3. * h - (2. * v0 + v1) * T) / (T * T);
+	      seg.c[3] = (-2. * h + (v0 + v1) * T) / (T * T * T);
+	    }
+	  segments.push_back (seg);
+	  t0 = t1;
+	  x0 = x1;
+	  v0 = v1;
+	  a0 = a1;
+	}
+      goalPositions[linkOf[j]] = x0;
+
+      // tolerances are matched by name, or else by position in the goal
+      for (unsigned int k = 0; k < goal.goal_tolerance.size (); k++)
+	if (goal.goal_tolerance[k].name == traj.joint_names[j]
+	    || (goal.goal_tolerance[k].name.empty () && k == j))
+	  {
+	    if (goal.goal_tolerance[k].position > 0)
+	      tolerances[linkOf[j]] = goal.goal_tolerance[k].position;
+	    break;
+	  }
+    }
+
+  trackSamples = 0;
+  trackMax = 0;
+  trackSumSq = 0;
+  active = true;
+  return true;
+}
+
+void
+UsarsimTrajectory::sample (double t, double *positions) const
+{
+  for (unsigned int i = 0; i < links.size (); i++)
+    {
+      const std::vector < Segment > &segments = links[i];
+      unsigned int lo = 0, hi = segments.size ();
+      const Segment *seg;
+      double s;
+
+      // last segment that starts at or before t
+      while (hi - lo > 1)
+	{
+	  unsigned int mid = (lo + hi) / 2;
+	  if (segments[mid].start <= t)
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+      seg = &segments[lo];
+      s = t - seg->start;
+      if (s < 0)
+	s = 0;
+      if (s > seg->length)
+	s = seg->length;
+      positions[i] = seg->c[0] + s * (seg->c[1] + s * (seg->c[2]
+						       + s * (seg->c[3]
+							      + s * (seg->c[4]
+								     + s * seg->c[5]))));
+    }
+}
+
+bool
+UsarsimTrajectory::atGoal (const double *positions, int number) const
+{
+  if (number < (int) goalPositions.size ())
+    return false;
+  for (unsigned int i = 0; i < goalPositions.size (); i++)
+    if (fabs (positions[i] - goalPositions[i]) > tolerances[i])
+      return false;
+  return true;
+}
+
+void
+UsarsimTrajectory::track (double t, const double *positions, int number)
+{
+  double planned[SW_ACT_LINK_MAX];
+  double worst = 0;
+  int n = links.size ();
+
+  if (n > SW_ACT_LINK_MAX)
+    n = SW_ACT_LINK_MAX;
+  if (number < n)
+    n = number;
+  sample (t, planned);
+  for (int i = 0; i < n; i++)
+    if (fabs (positions[i] - planned[i]) > worst)
+      worst = fabs (positions[i] - planned[i]);
+  trackSamples++;
+  trackSumSq += worst * worst;
+  if (worst > trackMax)
+    trackMax = worst;
+}
@@ -0,0 +1,73 @@
+/*****************************************************************************
+  DISCLAIMER:
+  This software was produced by the National Institute of Standards
+  and Technology (NIST), an agency of the U.S. government, and by statute is
+  not subject to copyright in the United States.  Recipients of this software
+  assume all responsibility associated with its operation, modification,
+  maintenance, and subsequent redistribution.
+
+  See NIST Administration Manual 4.09.07 b and Appendix I.
+*****************************************************************************/
+/*!
+  \file   usarsimTrajectory.hh
+  \brief  Joint trajectories as splines that can be sampled at any time.
+
+  When a FollowJointTrajectory goal is accepted, every joint gets one
+  polynomial per pair of points. Segments are quintic when the goal gives
+  accelerations. Otherwise they are cubic, using the goal's velocities or
+  estimating them from the neighbouring points. The servo's trajectory
+  task then samples the splines at a fixed rate.
+*/
+#ifndef __usarsimTrajectory__
+#define __usarsimTrajectory__
+#include <string>
+#include <vector>
+#include <control_msgs/FollowJointTrajectoryGoal.h>
+
+class UsarsimTrajectory
+{
+public:
+  UsarsimTrajectory ();
+  /*!
+    Fit the splines for goal, starting from the link positions in start.
+    jointNames are the actuator's joints in link order; goal joints are
+    matched to them by name, or taken in link order if none match.
+    Returns false and sets error if the goal can't be followed.
+  */
+  bool build (const control_msgs::FollowJointTrajectoryGoal & goal,
+	      const std::vector < std::string > &jointNames,
+	      const std::vector < double >&start, double defaultTolerance,
+	      double defaultGoalTime, std::string & error);
+  //! link positions t seconds into the trajectory
+  void sample (double t, double *positions) const;
+  //! true if every link is within its goal tolerance
+  bool atGoal (const double *positions, int number) const;
+  //! add the difference between positions and the plan at t to the statistics
+  void track (double t, const double *positions, int number);
+  int getLinks () const
+  {
+    return links.size ();
+  }
+
+  bool active;
+  double startTime;		//!< ulapi_monotime the trajectory started
+  double duration;		//!< time of the last point
+  double goalTime;		//!< time after duration allowed to reach the goal
+  unsigned long trackSamples;	//!< statuses compared to the plan
+  double trackMax;		//!< largest link error seen
+  double trackSumSq;		//!< sum of squared largest link errors
+
+private:
+  class Segment
+  {
+  public:
+    double start;		// seconds into the trajectory
+    double length;		// seconds
+    double c[6];		// p(s) = c0 + c1 s + ... + c5 s^5, s = t - start
+  };
+  std::vector < std::vector < Segment > >links;
+  std::vector < double >goalPositions;
+  std::vector < double >tolerances;
+};
+
+#endif
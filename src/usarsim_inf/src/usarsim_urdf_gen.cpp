@@ -142,7 +142,7 @@ main (int argc, char **argv)
   
   //loop through all actuators, adding link elements
   i = 0;
-  for(std::list<UsarsimActuator>::iterator it = servo->getActuatorBegin();it != servo->getActuatorEnd();it++)
+  for(std::vector<UsarsimActuator>::iterator it = servo->getActuatorBegin();it != servo->getActuatorEnd();it++)
   {
     actPt = (UsarsimActuator*)(&*it);
     platformSize = servo->getPlatformSize();
@@ -182,7 +182,7 @@ main (int argc, char **argv)
     ROS_ERROR("Done with component links.");
     i = 0;
     //now add the joint elements
-    for(std::list<UsarsimActuator>::iterator it = servo->getActuatorBegin();it != servo->getActuatorEnd();it++)
+    for(std::vector<UsarsimActuator>::iterator it = servo->getActuatorBegin();it != servo->getActuatorEnd();it++)
     {
     	actPt = (UsarsimActuator*)(&*it);
       	platformSize = servo->getPlatformSize();
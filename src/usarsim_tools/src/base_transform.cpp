@@ -1,5 +1,7 @@
 #include <ros/ros.h>
-#include <tf/transform_broadcaster.h>
+#include <tf/transform_datatypes.h>
+#include <tf2_ros/static_transform_broadcaster.h>
+#include <geometry_msgs/TransformStamped.h>
 #include <string>
 
 int main(int argc, char** argv)
@@ -13,20 +15,19 @@ int main(int argc, char** argv)
 	  ROS_WARN("usarsim/globalFrame not specified. Using default global frame.");
 	  exit(1);
 	}
-	ros::Rate r(2.0);
-	tf::TransformBroadcaster broadcaster;
+	tf2_ros::StaticTransformBroadcaster broadcaster;
 	tf::Transform transform;
+	geometry_msgs::TransformStamped msg;
 	transform.setOrigin(tf::Vector3(0,0,0));
 	//reflect y and z axes
-	btMatrix3x3 rotationMatrix(
+	tf::Matrix3x3 rotationMatrix(
 	  1,  0,  0,
 	  0, -1,  0,
 	  0,  0, -1);
 	transform.setBasis(rotationMatrix);
-	while(ros::ok())
-	{
-		broadcaster.sendTransform(tf::StampedTransform(transform, ros::Time::now(), globalFrame, "odom"));
-		r.sleep();
-	}
+	//the transform never changes, so send it once, latched on /tf_static
+	tf::transformStampedTFToMsg(tf::StampedTransform(transform, ros::Time::now(), globalFrame, "odom"), msg);
+	broadcaster.sendTransform(msg);
+	ros::spin();
 	return 0;
 }